@@ -3,15 +3,24 @@
 #include <memory>
 #include "spdlog/spdlog.h"
 #include "json.hpp"
+#include "mantisconfig.hpp"
 
 
 class BuildOpts {
  public:
 	bool flush_eqclass_dist{false};
-	int qbits;
+	bool build_mst{false};
+	bool static_map{false};
+	bool pack_color_ids{false};
+	bool color_matrix{false};
+	// 0: sized from an estimate of the number of k-mers
+	int qbits{0};
   std::string inlist;
   std::string out;
 	int numthreads{1};
+	uint64_t readahead_mb{mantis::READAHEAD_BUDGET_MB};
+	uint64_t group_size{0};
+	uint64_t eqclass_buffer_mb{0};
   std::shared_ptr<spdlog::logger> console{nullptr};
 
   nlohmann::json to_json() {
@@ -21,6 +30,13 @@ class BuildOpts {
     j["input_list"] = inlist;
     j["output_dir"] = out;
     j["num_threads"] = numthreads;
+    j["build_mst"] = build_mst;
+    j["static_map"] = static_map;
+    j["pack_color_ids"] = pack_color_ids;
+    j["color_matrix"] = color_matrix;
+    j["readahead_mb"] = readahead_mb;
+    j["group_size"] = group_size;
+    j["eqclass_buffer_mb"] = eqclass_buffer_mb;
     return j;
   }
 };
@@ -33,11 +49,21 @@ class QueryOpts {
   uint64_t k = 0;
   uint32_t numThreads = 1;
   bool use_json{false};
+  bool use_binary{false};
+  bool gzip{false};
+  // > 0: only the samples with at least this fraction of the k-mers of a query
+  double theta{0};
+  // > 0: only the top samples with the most k-mers of a query
+  uint64_t top{0};
   std::shared_ptr<spdlog::logger> console{nullptr};
   bool process_in_bulk{false};
   bool use_colorclasses{false};
   bool keep_colorclasses{false};
   bool remove_colorClasses{false};
+  bool resume_mst{false};
+  bool gap_encode_deltas{false};
+  bool huge_pages{false};
+  bool numa_interleave{false};
 };
 
 class ValidateOpts {
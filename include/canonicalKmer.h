@@ -5,7 +5,11 @@
 #ifndef MANTIS_CANONICALKMER_H
 #define MANTIS_CANONICALKMER_H
 
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
 #include <map>
+#include <type_traits>
 
 namespace dna {
 
@@ -79,6 +83,72 @@ namespace dna {
 
         canonical_kmer(kmer k);
     };
+
+// Operations on the values of k-mers whose length is known at compile time,
+// for the loops that run once or more per k-mer of an index.
+// Values are encoded as in kmer, and canonical has the meaning of canonicalize.
+    template<uint32_t K>
+    struct fixed_kmer {
+        static_assert(K >= 1 && K <= 32, "a k-mer is at most 32 bases");
+        static constexpr uint64_t mask = K == 32 ? ~0ULL : (1ULL << (2 * K)) - 1;
+
+        static uint64_t reverse_complement(uint64_t val) {
+            val = __builtin_bswap64(val);
+            val = ((val >> 4) & 0x0f0f0f0f0f0f0f0f) | ((val << 4) & 0xf0f0f0f0f0f0f0f0);
+            val = ((val >> 2) & 0x3333333333333333) | ((val << 2) & 0xcccccccccccccccc);
+            return ~val >> (64 - 2 * K);
+        }
+
+        static uint64_t canonicalize(uint64_t val) {
+            uint64_t rc = reverse_complement(val);
+            return rc < val ? val : rc;
+        }
+
+        // calls fn(neighbor) in increasing order for each distinct canonical k-mer
+        // obtained by shifting a base into val from the right or from the left
+        template<class F>
+        static void for_each_neighbor(uint64_t val, F fn) {
+            uint64_t neighbors[8];
+            uint32_t n = 0;
+            auto add = [&](uint64_t nei) {
+                uint32_t i = n;
+                for (; i > 0 && neighbors[i - 1] >= nei; --i) {
+                    if (neighbors[i - 1] == nei) {
+                        return;
+                    }
+                }
+                for (uint32_t j = n; j > i; --j) {
+                    neighbors[j] = neighbors[j - 1];
+                }
+                neighbors[i] = nei;
+                ++n;
+            };
+            for (uint64_t b = 0; b < 4; ++b) {
+                add(canonicalize(((val << 2) | b) & mask));
+                add(canonicalize((val >> 2) | (b << (2 * K - 2))));
+            }
+            for (uint32_t i = 0; i < n; ++i) {
+                fn(neighbors[i]);
+            }
+        }
+    };
+
+// Returns fn(std::integral_constant<uint32_t, k>()), through which fn can use fixed_kmer<k>
+    template<uint32_t K = 1, class F>
+    auto with_kmer_length(uint32_t k, F fn) {
+        if constexpr (K == 32) {
+            if (k != K) {
+                std::cerr << "k-mers of length " << k << " are not supported.\n";
+                std::exit(1);
+            }
+            return fn(std::integral_constant<uint32_t, K>());
+        } else {
+            if (k == K) {
+                return fn(std::integral_constant<uint32_t, K>());
+            }
+            return with_kmer_length<K + 1>(k, fn);
+        }
+    }
 }
 
 #endif //MANTIS_CANONICALKMER_H
@@ -0,0 +1,109 @@
+#ifndef MANTIS_COLORMATRIX_H
+#define MANTIS_COLORMATRIX_H
+
+#include <cstdint>
+#include <string>
+
+#include "sdsl/bit_vectors.hpp"
+#include "mantisconfig.hpp"
+
+/**
+ * Color classes of an index in a layout meant for queries (mantis build --color-matrix)
+ * Each row (color class) is encoded on its own, in the smallest of: the sorted ids
+ * of its samples as 16 or 32-bit integers, the raw bit vector, or the lengths of
+ * its alternating runs of absent and present samples.
+ * An offset per row gives direct access to any row, and the file is mmapped as is.
+ */
+class ColorMatrix {
+public:
+    enum RowEncoding : uint8_t {
+        LIST16 = 0, LIST32 = 1, RAW = 2, RUNS = 3
+    };
+
+    // encodes the numRows rows of numSamples bits stored one after the other in bits
+    static void write(const sdsl::bit_vector &bits, uint64_t numRows, uint64_t numSamples,
+                      const std::string &filename);
+
+    ColorMatrix() = default;
+
+    ColorMatrix(const ColorMatrix &) = delete;
+
+    ColorMatrix &operator=(const ColorMatrix &) = delete;
+
+    ColorMatrix(ColorMatrix &&other) noexcept;
+
+    ~ColorMatrix();
+
+    bool load(const std::string &filename);
+
+    uint64_t rows() const { return header ? header->numRows : 0; }
+
+    uint64_t samples() const { return header ? header->numSamples : 0; }
+
+    // calls fn(sample) for every sample of the row, in increasing order
+    template<class F>
+    void forEachSample(uint64_t row, F fn) const {
+        const uint8_t *p = data + offsets[row];
+        if (encodings[row] == RAW) {
+            const uint64_t *words = reinterpret_cast<const uint64_t *>(p);
+            for (uint64_t w = 0; w * 64 < header->numSamples; ++w) {
+                for (uint64_t word = words[w]; word; word &= word - 1) {
+                    fn(w * 64 + __builtin_ctzll(word));
+                }
+            }
+            return;
+        }
+        uint32_t n = *reinterpret_cast<const uint32_t *>(p);
+        p += sizeof(uint32_t);
+        if (encodings[row] == LIST16) {
+            const uint16_t *ids = reinterpret_cast<const uint16_t *>(p);
+            for (uint32_t i = 0; i < n; ++i) {
+                fn(ids[i]);
+            }
+        } else if (encodings[row] == LIST32) {
+            const uint32_t *ids = reinterpret_cast<const uint32_t *>(p);
+            for (uint32_t i = 0; i < n; ++i) {
+                fn(ids[i]);
+            }
+        } else {
+            // runs of absent samples at even positions, of present ones at odd positions
+            const uint32_t *runs = reinterpret_cast<const uint32_t *>(p);
+            uint64_t sample = 0;
+            for (uint32_t i = 0; i < n; ++i) {
+                if (i & 1) {
+                    for (uint64_t end = sample + runs[i]; sample < end; ++sample) {
+                        fn(sample);
+                    }
+                } else {
+                    sample += runs[i];
+                }
+            }
+        }
+    }
+
+    // whether the row has the sample, without decoding the whole row
+    bool contains(uint64_t row, uint64_t sample) const;
+
+private:
+    struct Header {
+        uint64_t magic{mantis::COLOR_MATRIX_MAGIC};
+        uint32_t version{mantis::COLOR_MATRIX_VERSION};
+        uint32_t reserved{0};
+        uint64_t numSamples{0};
+        uint64_t numRows{0};
+        uint64_t dataBytes{0};
+    };
+
+    static uint64_t paddedEncodings(uint64_t numRows) { return (numRows + 7) / 8 * 8; }
+
+    // the whole file
+    void *mapping{nullptr};
+    uint64_t mappedBytes{0};
+    const Header *header{nullptr};
+    // numRows + 1 offsets of the rows in data, each row starts on 8 bytes
+    const uint64_t *offsets{nullptr};
+    const uint8_t *encodings{nullptr};
+    const uint8_t *data{nullptr};
+};
+
+#endif //MANTIS_COLORMATRIX_H
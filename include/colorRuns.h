@@ -0,0 +1,122 @@
+#ifndef MANTIS_COLORRUNS_H
+#define MANTIS_COLORRUNS_H
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "sparsepp/spp.h"
+#include "sdsl/bit_vectors.hpp"
+#include "gqf_cpp.h"
+#include "mantisconfig.hpp"
+
+/**
+ * Partial result of the hierarchical build (mantis build --group-size)
+ * A color run holds the k-mers of a group of consecutive samples in hash order,
+ * each with the id of its color class within the run.
+ * The color classes (bit vectors over the samples of the run) are written once,
+ * in a table after the k-mers. The hashes are gap-encoded and the hash gaps and
+ * class ids are written as variable-length bytes.
+ */
+class ColorRunWriter {
+public:
+    ColorRunWriter(const std::string &filename, uint64_t numSamples);
+
+    // the k-mers must be added in increasing hash order
+    void add(uint64_t hash, const sdsl::bit_vector &colors);
+
+    // writes the color class table and the final header
+    void close();
+
+    uint64_t kmers() const { return header.numKmers; }
+
+    uint64_t colorClasses() const { return header.numClasses; }
+
+private:
+    struct Header {
+        uint64_t magic{mantis::COLOR_RUN_MAGIC};
+        uint32_t version{mantis::COLOR_RUN_VERSION};
+        uint32_t reserved{0};
+        uint64_t numSamples{0};
+        uint64_t numKmers{0};
+        uint64_t numClasses{0};
+        uint64_t tableOffset{0};
+    };
+    friend class ColorRunReader;
+
+    struct ClassHasher {
+        uint64_t operator()(const __uint128_t &h) const { return static_cast<uint64_t>(h); }
+    };
+
+    void putVarint(uint64_t v);
+
+    std::string filename;
+    std::ofstream out;
+    Header header;
+    uint64_t words;
+    uint64_t lastHash{0};
+    uint64_t offset{sizeof(Header)};
+    // MurmurHash128A of the color class --> id in the run
+    spp::sparse_hash_map<__uint128_t, uint64_t, ClassHasher> classIds;
+    std::vector<uint64_t> table;
+};
+
+/**
+ * Reads the k-mers of a color run back in hash order.
+ */
+class ColorRunReader {
+public:
+    explicit ColorRunReader(const std::string &filename);
+
+    // moves to the next k-mer, false after the last one
+    bool next();
+
+    uint64_t hash() const { return curHash; }
+
+    uint64_t samples() const { return header.numSamples; }
+
+    uint64_t kmers() const { return header.numKmers; }
+
+    // sets the bits of the samples of the current k-mer in colors, from bit offset on
+    void addColors(sdsl::bit_vector &colors, uint64_t offset) const;
+
+private:
+    uint64_t getVarint();
+
+    std::ifstream in;
+    ColorRunWriter::Header header;
+    uint64_t words{0};
+    std::vector<uint64_t> table;
+    uint64_t kmersRead{0};
+    uint64_t curHash{0};
+    uint64_t curClass{0};
+};
+
+/**
+ * Merges color runs of disjoint, consecutive groups of samples into the k-mers of
+ * the union of the groups, with their colors over all the samples.
+ */
+class ColorRunMerger {
+public:
+    explicit ColorRunMerger(const std::vector<std::string> &filenames);
+
+    uint64_t samples() const { return numSamples; }
+
+    // the next k-mer in hash order and its colors, false when all the runs are merged
+    bool next(uint64_t &hash, sdsl::bit_vector &colors);
+
+private:
+    std::vector<std::unique_ptr<ColorRunReader>> runs;
+    // first sample of each run
+    std::vector<uint64_t> offsets;
+    // (hash, run) of the current k-mer of every run that is not exhausted
+    std::vector<std::pair<uint64_t, uint32_t>> heap;
+    uint64_t numSamples{0};
+};
+
+// merges the k-mers of the input CQFs (one per sample) into a color run
+void writeColorRun(const std::vector<const CQF<KeyObject> *> &cqfs, const std::string &filename);
+
+#endif //MANTIS_COLORRUNS_H
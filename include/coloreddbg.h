@@ -17,6 +17,10 @@
 #include <set>
 #include <unordered_set>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 
 #include <inttypes.h>
 
@@ -24,12 +28,20 @@
 #include "tsl/sparse_map.h"
 #include "sdsl/bit_vectors.hpp"
 #include "gqf_cpp.h"
+#include "dbgColorIds.h"
 #include "gqf/hashutil.h"
+#include "canonicalKmer.h"
 #include "common_types.h"
 #include "mantisconfig.hpp"
+#include "staticKmerMap.h"
+#include "colorRuns.h"
+#include "colorMatrix.h"
+#include "queryFilter.h"
 
 #define MANTIS_DBG_IN_MEMORY (0x01)
 #define MANTIS_DBG_ON_DISK (0x02)
+// the dbg is a static k-mer map (mantis build --static-map), query only
+#define MANTIS_DBG_STATIC_MAP (0x03)
 
 typedef sdsl::bit_vector BitVector;
 typedef sdsl::rrr_vector<63> BitVectorRRR;
@@ -59,13 +71,24 @@ class ColoredDbg {
 		ColoredDbg(uint64_t qbits, uint64_t key_bits, enum qf_hashmode hashmode,
 							 uint32_t seed, std::string& prefix, uint64_t nqf, int flag);
 
+		~ColoredDbg() { wait_for_bv_serializer(); }
+
 		void build_sampleid_map(qf_obj *incqfs);
 
 		default_cdbg_bv_map_t&
 			construct(qf_obj *incqfs, uint64_t num_kmers);
 
+		// hierarchical build, from the color runs of the groups of samples
+		default_cdbg_bv_map_t&
+			construct(const std::vector<std::string>& run_files, uint64_t
+								num_kmers);
+
 		void set_console(spdlog::logger* c) { console = c; }
 		const CQF<key_obj> *get_cqf(void) const { return &dbg; }
+		uint32_t get_key_bits(void) const { return dbg_alloc_flag ==
+			MANTIS_DBG_STATIC_MAP ? static_dbg.keybits() : dbg.keybits(); }
+		uint64_t get_num_kmers(void) const { return dbg_alloc_flag ==
+			MANTIS_DBG_STATIC_MAP ? static_dbg.dist_elts() : dbg.dist_elts(); }
 		uint64_t get_num_bitvectors(void) const;
 		uint64_t get_num_eqclasses(void) const { return eqclass_map.size(); }
 		uint64_t get_num_samples(void) const { return num_samples; }
@@ -73,8 +96,10 @@ class ColoredDbg {
 		uint32_t seed(void) const { return dbg.seed(); }
 		uint64_t range(void) const { return dbg.range(); }
 
-		std::vector<uint64_t>
-			find_samples(const mantis::QuerySet& kmers);
+		// clears result and counts the k-mers of each sample in it, only of the
+		// samples that filter reports
+		void find_samples(const mantis::QuerySet& kmers, mantis::QueryResult&
+											result, const QueryFilter& filter = QueryFilter());
 
         std::unordered_map<uint64_t, std::vector<uint64_t>>
             find_samples(const std::unordered_map<mantis::KmerHash, uint64_t> &uniqueKmers);
@@ -82,31 +107,178 @@ class ColoredDbg {
 		void serialize();
 		void reinit(default_cdbg_bv_map_t& map);
 		void set_flush_eqclass_dist(void) { flush_eqclass_dis = true; }
+		void set_collect_mst_edges(void) { collect_mst_edges = true; }
+		void set_pack_color_ids(void) { pack_color_ids = true; }
+		void set_color_matrix(void) { color_matrix = true; }
+		void set_num_threads(uint32_t n) { num_threads = n; }
+		void set_readahead_budget(uint64_t bytes) { readahead_budget = bytes; }
+		void set_bv_buffer_rows(uint64_t rows) { bv_buffer_rows = rows; }
+		std::string get_mst_edge_file(void) const { return prefix +
+			mantis::MST_EDGES_TMP_FILE; }
 
 	private:
+		// iterator over the k-mer hashes of one input CQF in the merge
+		struct MergeIterator {
+			QFi qfi;
+			typename key_obj::kmer_t kmer;
+			uint32_t id;
+			bool do_madvice{false};
+			MergeIterator(uint32_t id, const QF* cqf, bool flag): id(id),
+			do_madvice(flag) {
+				if (qf_iterator_from_position(cqf, &qfi, 0) != QFI_INVALID) {
+					get_key();
+					if (do_madvice)
+						qfi_initial_madvise(&qfi);
+				}
+			}
+			// starts from the first k-mer with a hash >= start_hash
+			// pages before start_hash belong to other merge threads, so they are
+			// not dropped
+			MergeIterator(uint32_t id, const QF* cqf, uint64_t start_hash, bool
+										flag): id(id), do_madvice(flag) {
+				if (qf_iterator_from_key_value(cqf, &qfi, start_hash, 0,
+																			 QF_KEY_IS_HASH) != QFI_INVALID &&
+						!qfi_end(&qfi))
+					get_key();
+			}
+			bool next() {
+				if (do_madvice) {
+					if (qfi_next_madvise(&qfi) == QFI_INVALID) return false;
+				} else {
+					if (qfi_next(&qfi) == QFI_INVALID) return false;
+				}
+				get_key();
+				return true;
+			}
+			bool end() const {
+				return qfi_end(&qfi);
+			}
+			bool operator>(const MergeIterator& rhs) const {
+				return key() > rhs.key();
+			}
+			const typename key_obj::kmer_t& key() const { return kmer; }
+			private:
+			void get_key() {
+				uint64_t value, count;
+				qfi_get_hash(&qfi, &kmer, &value, &count);
+			}
+		};
+
+		struct MergeHeap {
+			void push(const MergeIterator& obj) {
+				c.emplace_back(obj);
+				std::push_heap(c.begin(), c.end(), std::greater<MergeIterator>());
+			}
+			void pop() {
+				std::pop_heap(c.begin(), c.end(), std::greater<MergeIterator>());
+				c.pop_back();
+			}
+			void replace_top(const MergeIterator& obj) {
+				c.emplace_back(obj);
+				pop();
+			}
+			MergeIterator& top() { return c.front(); }
+			bool empty() const { return c.empty(); }
+			private:
+			std::vector<MergeIterator> c;
+		};
+
 		// returns true if adding this k-mer increased the number of equivalence
 		// classes
 		// and false otherwise.
 		bool add_kmer(const typename key_obj::kmer_t& hash, const BitVector&
 									vector);
+		uint64_t get_eq_class(const BitVector& vector, __uint128_t vec_hash,
+													uint64_t abundance, bool& added_eq_class);
+		template <class NextKmer>
+		void merge_kmers(NextKmer next_kmer, uint64_t num_kmers);
+		// what a thread of the parallel merge found in its range of hashes
+		struct MergeRange {
+			struct EqClass {
+				__uint128_t vec_hash;
+				uint64_t abundance;
+				// 0 until the eq class gets its id, unless it had one from the
+				// sampling phase. Otherwise its bit vector is in class_file.
+				uint64_t eq_id;
+			};
+			// (k-mer, index in classes) of each k-mer of the range, in order
+			std::string kmer_file;
+			std::string class_file;
+			// the eq classes of the range, in the order they are first seen
+			std::vector<EqClass> classes;
+		};
+		void construct_parallel(qf_obj *incqfs);
+		void merge_range(qf_obj *incqfs, uint64_t start_hash, __uint128_t
+										 end_hash, MergeRange& range);
+		void assign_eq_ids(MergeRange& range);
+		void insert_range(MergeRange& range);
+		void insert_kmer(const typename key_obj::kmer_t& hash, uint64_t eq_id,
+										 std::shared_lock<std::shared_mutex>& dbg_lock);
+		void wait_for_resize(std::shared_lock<std::shared_mutex>& dbg_lock);
+		void add_color_graph_edges(const typename key_obj::kmer_t& hash, uint64_t
+															 eq_id);
+		void mst_edges_flush(void);
+		void pack_dbg(void);
 		void add_bitvector(const BitVector& vector, uint64_t eq_id);
 		void add_eq_class(BitVector vector, uint64_t id);
 		uint64_t get_next_available_id(void);
 		void bv_buffer_serialize();
+		void wait_for_bv_serializer(void) {
+			if (bv_serializer.joinable())
+				bv_serializer.join();
+		}
 		void reshuffle_bit_vectors(cdbg_bv_map_t<__uint128_t, std::pair<uint64_t,
 															 uint64_t>>& map);
+		// count (eq class id + 1) of the k-mer in the dbg, 0 if absent
+		uint64_t query_dbg(const key_obj& key) {
+			return dbg_alloc_flag == MANTIS_DBG_STATIC_MAP ? static_dbg.query(key, 0)
+				: dbg_eqclass(dbg, key, 0);
+		}
+		// calls fn(sample) for every sample of the eq class (ids start from 1)
+		template <class F>
+		void for_each_sample(uint64_t eqclass_id, F fn) const;
+		bool has_sample(uint64_t eqclass_id, uint64_t sample) const;
 
 		std::unordered_map<uint64_t, std::string> sampleid_map;
 		// bit_vector --> <eq_class_id, abundance>
 		cdbg_bv_map_t<__uint128_t, std::pair<uint64_t, uint64_t>> eqclass_map;
 		CQF<key_obj> dbg;
+		StaticKmerMap static_dbg;
+		// eq classes since the last serialization, bv_buffer_rows at most. It is
+		// grown as eq classes are added.
 		BitVector bv_buffer;
+		uint64_t bv_buffer_rows{mantis::NUM_BV_BUFFER};
+		// compresses and writes the previous bv_buffer
+		std::thread bv_serializer;
 		std::vector<BitVectorRRR> eqclasses;
+		// eq classes of an index built with --color-matrix, instead of eqclasses
+		std::vector<ColorMatrix> color_matrices;
+		bool color_matrix{false};
+		// scratch space of find_samples with a filter
+		std::vector<std::pair<uint64_t, uint64_t>> query_colors;
+		std::vector<uint64_t> query_candidates;
 		std::string prefix;
 		uint64_t num_samples;
 		uint64_t num_serializations;
 		int dbg_alloc_flag;
 		bool flush_eqclass_dis{false};
+		// color graph edges found during the final merge, as the color ids of
+		// their ends packed in one integer, deduplicated before they are spilled
+		// to mst_edge_file as pairs of color ids (same layout as the MST's Edge)
+		bool collect_mst_edges{false};
+		spp::sparse_hash_set<uint64_t> mst_edges;
+		std::ofstream mst_edge_file;
+		uint64_t num_mst_edges{0};
+		// store the color ids in the value bits of a right-sized dbg (see pack_dbg)
+		bool pack_color_ids{false};
+		// threads of the final merge (see construct_parallel)
+		uint32_t num_threads{1};
+		// page cache the merge iterators may fill by reading their inputs ahead
+		uint64_t readahead_budget{0};
+		// held shared while inserting into the dbg and exclusively to resize it
+		std::shared_mutex dbg_resize_mutex;
+		std::atomic<uint32_t> resize_requests{0};
+		std::atomic<uint64_t> num_kmers_merged{0};
 		std::time_t start_time_;
 		spdlog::logger* console;
 };
@@ -150,25 +322,28 @@ std::string ColoredDbg<qf_obj, key_obj>::get_sample(uint32_t id) const {
 template <class qf_obj, class key_obj>
 uint64_t ColoredDbg<qf_obj, key_obj>::get_num_bitvectors(void) const {
 	uint64_t total = 0;
-	for (uint32_t i = 0; i < num_serializations; i++)
+	for (uint32_t i = 0; i < eqclasses.size(); i++)
 		total += eqclasses[i].size();
 
-	return total / num_samples;
+	total /= num_samples;
+	for (auto& matrix : color_matrices)
+		total += matrix.rows();
+	return total;
 }
 
 template <class qf_obj, class key_obj>
 void ColoredDbg<qf_obj,
 		 key_obj>::reshuffle_bit_vectors(cdbg_bv_map_t<__uint128_t,
 																		 std::pair<uint64_t, uint64_t>>& map) {
-			 BitVector new_bv_buffer(mantis::NUM_BV_BUFFER * num_samples);
+			 BitVector new_bv_buffer(bv_buffer.bit_size());
 			 for (auto& it_input : map) {
 				 auto it_local = eqclass_map.find(it_input.first);
 				 if (it_local == eqclass_map.end()) {
 					 console->error("Can't find the vector hash during shuffling");
 					 exit(1);
 				 } else {
-					 assert(it_local->second.first <= mantis::NUM_BV_BUFFER &&
-									it_input.second.first <= mantis::NUM_BV_BUFFER);
+					 assert(it_local->second.first <= bv_buffer_rows &&
+									it_input.second.first <= bv_buffer_rows);
 					 uint64_t src_idx = ((it_local->second.first - 1) * num_samples);
 					 uint64_t dest_idx = ((it_input.second.first - 1) * num_samples);
 					 for (uint32_t i = 0; i < num_samples; i++, src_idx++, dest_idx++)
@@ -190,11 +365,12 @@ void ColoredDbg<qf_obj, key_obj>::reinit(cdbg_bv_map_t<__uint128_t,
 	dbg.delete_file();
 	CQF<key_obj>cqf(qbits, keybits, hashmode, seed, prefix + mantis::CQF_FILE);
 	dbg = cqf;
+	dbg.set_auto_resize();
 
 	reshuffle_bit_vectors(map);
 	// Check if the current bit vector buffer is full and needs to be serialized.
 	// This happens when the sampling phase fills up the bv buffer.
-	if (get_num_eqclasses() % mantis::NUM_BV_BUFFER == 0) {
+	if (get_num_eqclasses() % bv_buffer_rows == 0) {
 		// The bit vector buffer is full.
 		console->info("Serializing bit vector with {} eq classes.",
 									get_num_eqclasses());
@@ -208,13 +384,42 @@ bool ColoredDbg<qf_obj, key_obj>::add_kmer(const typename key_obj::kmer_t&
 																					 key, const BitVector& vector) {
 	// A kmer (hash) is seen only once during the merge process.
 	// So we insert every kmer in the dbg
-	uint64_t eq_id;
 	__uint128_t vec_hash = MurmurHash128A((void*)vector.data(),
 																				vector.capacity()/8, 2038074743,
 																				2038074751);
+	bool added_eq_class{false};
+	uint64_t eq_id = get_eq_class(vector, vec_hash, 1, added_eq_class);
+
+	// The merge yields k-mers in increasing hash order, so they are appended to
+	// the dbg left to right. This also checks the k-mer is not already present.
+	// we use the count to store the eqclass ids
+	int ret = dbg.append_sorted(KeyObject(key,0,eq_id), QF_NO_LOCK |
+															QF_KEY_IS_HASH);
+	if (ret == QF_NOT_SORTED) {
+		console->error("K-mer was not merged in increasing hash order. kmer: {}", key);
+		exit(1);
+	} else if (ret == QF_NO_SPACE) {
+		// This means that auto_resize failed. 
+		console->error("The CQF is full and auto resize failed. Please rerun build with a bigger size.");
+		exit(1);
+	}
+
+	if (mst_edge_file.is_open())
+		add_color_graph_edges(key, eq_id);
 
+	return added_eq_class;
+}
+
+/* Returns the id of the eq class of the vector and adds abundance to it.
+ * The eq class is created if it is seen for the first time.
+ */
+template <class qf_obj, class key_obj>
+uint64_t ColoredDbg<qf_obj, key_obj>::get_eq_class(const BitVector& vector,
+																									 __uint128_t vec_hash,
+																									 uint64_t abundance, bool&
+																									 added_eq_class) {
+	uint64_t eq_id;
 	auto it = eqclass_map.find(vec_hash);
-	bool added_eq_class{false};
 	// Find if the eqclass of the kmer is already there.
 	// If it is there then increment the abundance.
 	// Else create a new eq class.
@@ -223,38 +428,85 @@ bool ColoredDbg<qf_obj, key_obj>::add_kmer(const typename key_obj::kmer_t&
 		eq_id = get_next_available_id();
 		eqclass_map.emplace(std::piecewise_construct,
 												std::forward_as_tuple(vec_hash),
-												std::forward_as_tuple(eq_id, 1));
+												std::forward_as_tuple(eq_id, abundance));
 		add_bitvector(vector, eq_id - 1);
 		added_eq_class = true;
 	} else { // eq class is seen before so increment the abundance.
 		eq_id = it->second.first;
 		// with standard map
-		it->second.second += 1; // update the abundance.
+		it->second.second += abundance; // update the abundance.
 	}
+	return eq_id;
+}
 
-	// check: the k-mer should not already be present.
-	uint64_t count = dbg.query(KeyObject(key,0,eq_id), QF_NO_LOCK |
-													   QF_KEY_IS_HASH);
-	if (count > 0) {
-		console->error("K-mer was already present. kmer: {} eqid: {}", key, count);
-		exit(1);
+/* Adds an edge to the color graph between the eq class of the k-mer and the
+ * eq class of each of its neighbors in the dbg.
+ * K-mers are inserted only once, so every neighbor already in the dbg has its
+ * final eq class and each pair of adjacent k-mers is seen exactly once (from
+ * the one inserted later).
+ */
+template <class qf_obj, class key_obj>
+void ColoredDbg<qf_obj, key_obj>::add_color_graph_edges(const typename
+																												key_obj::kmer_t&
+																												key, uint64_t
+																												eq_id) {
+	uint64_t key_bits = dbg.keybits();
+	dna::canonical_kmer node(key_bits / 2, hash_64i(key, key_bits == 64 ?
+																									0xffffffffffffffff : (1ULL <<
+																																				key_bits)
+																									- 1ULL));
+	for (const auto b : dna::bases) {
+		for (const auto& nei : {dna::canonical_kmer(node << b),
+				 dna::canonical_kmer(b >> node)}) {
+			uint64_t nei_eq_id = dbg.query(KeyObject(nei.val, 0, 0), QF_NO_LOCK);
+			if (nei_eq_id == 0 || nei_eq_id == eq_id)
+				continue;
+			// color ids in the MST start from 0
+			mst_edges.insert((std::min(eq_id, nei_eq_id) - 1) << 32 |
+											 (std::max(eq_id, nei_eq_id) - 1));
+		}
 	}
+	if (mst_edges.size() >= mantis::MST_EDGE_BUFFER_SIZE)
+		mst_edges_flush();
+}
 
-	// we use the count to store the eqclass ids
-	int ret = dbg.insert(KeyObject(key,0,eq_id), QF_NO_LOCK | QF_KEY_IS_HASH);
-	if (ret == QF_NO_SPACE) {
-		// This means that auto_resize failed. 
-		console->error("The CQF is full and auto resize failed. Please rerun build with a bigger size.");
-		exit(1);
+/* Writes the distinct edges collected since the last flush. An edge can still
+ * be written again after a flush, MST::bucketEdges removes those.
+ */
+template <class qf_obj, class key_obj>
+void ColoredDbg<qf_obj, key_obj>::mst_edges_flush(void) {
+	std::vector<uint32_t> edges;
+	edges.reserve(2 * mantis::MST_EDGE_IO_BATCH);
+	auto write_edges = [&]() {
+		mst_edge_file.write(reinterpret_cast<const char*>(edges.data()),
+												sizeof(uint32_t) * edges.size());
+		edges.clear();
+	};
+	for (auto edge : mst_edges) {
+		edges.push_back(edge >> 32);
+		edges.push_back(edge & 0xffffffff);
+		if (edges.size() == 2 * mantis::MST_EDGE_IO_BATCH)
+			write_edges();
 	}
-
-	return added_eq_class;
+	write_edges();
+	num_mst_edges += mst_edges.size();
+	mst_edges.clear();
 }
 
 template <class qf_obj, class key_obj>
 void ColoredDbg<qf_obj, key_obj>::add_bitvector(const BitVector& vector,
 																								uint64_t eq_id) {
-	uint64_t start_idx = (eq_id  % mantis::NUM_BV_BUFFER) * num_samples;
+	uint64_t start_idx = (eq_id  % bv_buffer_rows) * num_samples;
+	if (start_idx + num_samples > bv_buffer.bit_size()) {
+		// double the buffer up to bv_buffer_rows rows
+		uint64_t rows = std::max(2 * bv_buffer.bit_size() / num_samples,
+														 mantis::INITIAL_EQ_CLASSES);
+		rows = std::min(std::max(rows, eq_id % bv_buffer_rows + 1), bv_buffer_rows);
+		BitVector new_bv_buffer(rows * num_samples);
+		std::copy(bv_buffer.data(), bv_buffer.data() + bv_buffer.capacity() / 64,
+							new_bv_buffer.data());
+		bv_buffer = std::move(new_bv_buffer);
+	}
 	for (uint32_t i = 0; i < num_samples/64*64; i+=64)
 		bv_buffer.set_int(start_idx+i, vector.get_int(i, 64), 64);
 	if (num_samples%64)
@@ -263,33 +515,110 @@ void ColoredDbg<qf_obj, key_obj>::add_bitvector(const BitVector& vector,
 											num_samples%64);
 }
 
+/*
+ * Writes the eq classes of bv_buffer on a background thread while the merge
+ * goes on with an empty buffer.
+ */
 template <class qf_obj, class key_obj>
 void ColoredDbg<qf_obj, key_obj>::bv_buffer_serialize() {
-	BitVector bv_temp(bv_buffer);
-	if (get_num_eqclasses() % mantis::NUM_BV_BUFFER > 0) {
-		bv_temp.resize((get_num_eqclasses() % mantis::NUM_BV_BUFFER) *
-									 num_samples);
-	}
-
-	BitVectorRRR final_com_bv(bv_temp);
+	wait_for_bv_serializer();
+	uint64_t num_rows = get_num_eqclasses() % bv_buffer_rows;
+	if (num_rows == 0)
+		num_rows = bv_buffer_rows;
+	BitVector buffer(std::move(bv_buffer));
+	bv_buffer = BitVector();
+	if (buffer.bit_size() != num_rows * num_samples)
+		buffer.resize(num_rows * num_samples);
 	std::string bv_file(prefix + std::to_string(num_serializations) + "_" +
-											mantis::EQCLASS_FILE);
-	sdsl::store_to_file(final_com_bv, bv_file);
-	bv_buffer = BitVector(bv_buffer.bit_size());
+											(color_matrix ? mantis::COLOR_MATRIX_FILE :
+											 mantis::EQCLASS_FILE));
+	bv_serializer = std::thread([buffer = std::move(buffer), bv_file, num_rows,
+															this]() {
+		if (color_matrix) {
+			ColorMatrix::write(buffer, num_rows, num_samples, bv_file);
+		} else {
+			BitVectorRRR final_com_bv(buffer);
+			sdsl::store_to_file(final_com_bv, bv_file);
+		}
+	});
 	num_serializations++;
 }
 
+/*
+ * Rewrites the dbg so that every k-mer takes a single slot holding its color
+ * class id in the value bits, instead of the id being encoded as a
+ * (multi-slot) counter. Ids are given in decreasing abundance order, and the
+ * value width is the number of bits of the largest id. The new CQF is sized
+ * for the final number of k-mers, so it is usually smaller than the one that
+ * was grown during the build.
+ */
+template <class qf_obj, class key_obj>
+void ColoredDbg<qf_obj, key_obj>::pack_dbg(void) {
+	uint64_t num_kmers = dbg.dist_elts();
+	uint64_t max_id = get_num_eqclasses() ? get_num_eqclasses() - 1 : 0;
+	uint64_t value_bits = 1;
+	while (max_id >> value_bits)
+		value_bits++;
+	uint64_t qbits = NUM_Q_BITS;
+	while ((1ULL << qbits) * 0.9 < num_kmers)
+		qbits++;
+
+	std::string packed_file(prefix + mantis::CQF_FILE + ".packed");
+	CQF<key_obj> packed(qbits, dbg.keybits(), value_bits, dbg.hash_mode(),
+											dbg.seed(), packed_file);
+	packed.set_auto_resize();
+	for (auto it = dbg.begin(); !it.done(); ++it) {
+		key_obj hash = it.get_cur_hash();
+		int ret = packed.append_sorted(key_obj(hash.key, hash.count - 1, 1),
+																	 QF_NO_LOCK | QF_KEY_IS_HASH);
+		if (ret < 0) {
+			console->error("Packing the color ids of the dbg failed. kmer: {}", hash.key);
+			exit(1);
+		}
+	}
+	console->info("Packed {} color ids in {}-bit values ({} -> {} bytes).",
+								num_kmers, value_bits, dbg.size_in_bytes(),
+								packed.size_in_bytes());
+
+	if (dbg_alloc_flag == MANTIS_DBG_IN_MEMORY)
+		dbg.free();
+	else
+		dbg.delete_file();
+	if (std::rename(packed_file.c_str(), (prefix + mantis::CQF_FILE).c_str())) {
+		console->error("Could not rename {} to {}", packed_file, prefix +
+									 mantis::CQF_FILE);
+		exit(1);
+	}
+	// the packed dbg is already in its final file, serialize only closes it
+	dbg = packed;
+	dbg_alloc_flag = MANTIS_DBG_ON_DISK;
+}
+
 template <class qf_obj, class key_obj>
 void ColoredDbg<qf_obj, key_obj>::serialize() {
 	// serialize the CQF
+	if (pack_color_ids)
+		pack_dbg();
 	if (dbg_alloc_flag == MANTIS_DBG_IN_MEMORY)
 		dbg.serialize(prefix + mantis::CQF_FILE);
 	else
 		dbg.close();
 
 	// serialize the bv buffer last time if needed
-	if (get_num_eqclasses() % mantis::NUM_BV_BUFFER > 0)
+	if (get_num_eqclasses() % bv_buffer_rows > 0)
 		bv_buffer_serialize();
+	wait_for_bv_serializer();
+
+	// write the last color graph edges and the total number of edges at the
+	// beginning of the file
+	if (mst_edge_file.is_open()) {
+		mst_edges_flush();
+		mst_edge_file.seekp(0);
+		mst_edge_file.write(reinterpret_cast<const char*>(&num_mst_edges),
+												sizeof(num_mst_edges));
+		mst_edge_file.close();
+		console->info("Collected {} color graph edges.", num_mst_edges);
+	}
 
 	//serialize the eq class id map
 	std::ofstream opfile(prefix + mantis::SAMPLEID_FILE);
@@ -308,37 +637,77 @@ void ColoredDbg<qf_obj, key_obj>::serialize() {
 }
 
 template <class qf_obj, class key_obj>
-std::vector<uint64_t>
-ColoredDbg<qf_obj,key_obj>::find_samples(const mantis::QuerySet& kmers) {
+void ColoredDbg<qf_obj,key_obj>::find_samples(const mantis::QuerySet& kmers,
+																							mantis::QueryResult& result,
+																							const QueryFilter& filter) {
 	// Find a list of eq classes and the number of kmers that belong those eq
 	// classes.
 	std::unordered_map<uint64_t, uint64_t> query_eqclass_map;
 	for (auto k : kmers) {
 		key_obj key(k, 0, 0);
-		uint64_t eqclass = dbg.query(key, 0);
+		uint64_t eqclass = query_dbg(key);
 		if (eqclass)
 			query_eqclass_map[eqclass] += 1;
 	}
 
-	std::vector<uint64_t> sample_map(num_samples, 0);
+	if (filter.enabled()) {
+		query_colors.clear();
+		for (auto& kv : query_eqclass_map)
+			query_colors.emplace_back(kv.second, kv.first);
+		countFilteredSamples(query_colors, kmers.size(), filter, result,
+												 query_candidates,
+												 [this](uint64_t eqclass_id, auto fn) {
+													 for_each_sample(eqclass_id, fn);
+												 },
+												 [this](uint64_t eqclass_id, uint64_t sample) {
+													 return has_sample(eqclass_id, sample);
+												 });
+		return;
+	}
+
+	result.clear();
 	for (auto it = query_eqclass_map.begin(); it != query_eqclass_map.end();
 			 ++it) {
 		auto eqclass_id = it->first;
 		auto count = it->second;
-		// counter starts from 1.
-		uint64_t start_idx = (eqclass_id - 1);
-		uint64_t bucket_idx = start_idx / mantis::NUM_BV_BUFFER;
-		uint64_t bucket_offset = (start_idx % mantis::NUM_BV_BUFFER) * num_samples;
-		for (uint32_t w = 0; w <= num_samples / 64; w++) {
-			uint64_t len = std::min((uint64_t)64, num_samples - w * 64);
-			uint64_t wrd = eqclasses[bucket_idx].get_int(bucket_offset, len);
-			for (uint32_t i = 0, sCntr = w * 64; i < len; i++, sCntr++)
-				if ((wrd >> i) & 0x01)
-					sample_map[sCntr] += count;
-			bucket_offset += len;
-		}
+		for_each_sample(eqclass_id, [&](uint64_t sample) {
+			result.add(sample, count);
+		});
 	}
-	return sample_map;
+}
+
+template <class qf_obj, class key_obj>
+template <class F>
+void ColoredDbg<qf_obj, key_obj>::for_each_sample(uint64_t eqclass_id, F fn)
+	const {
+	// counter starts from 1.
+	uint64_t start_idx = (eqclass_id - 1);
+	uint64_t bucket_idx = start_idx / bv_buffer_rows;
+	if (!color_matrices.empty()) {
+		color_matrices[bucket_idx].forEachSample(start_idx % bv_buffer_rows, fn);
+		return;
+	}
+	uint64_t bucket_offset = (start_idx % bv_buffer_rows) * num_samples;
+	for (uint32_t w = 0; w <= num_samples / 64; w++) {
+		uint64_t len = std::min((uint64_t)64, num_samples - w * 64);
+		uint64_t wrd = eqclasses[bucket_idx].get_int(bucket_offset, len);
+		for (uint32_t i = 0, sCntr = w * 64; i < len; i++, sCntr++)
+			if ((wrd >> i) & 0x01)
+				fn(sCntr);
+		bucket_offset += len;
+	}
+}
+
+template <class qf_obj, class key_obj>
+bool ColoredDbg<qf_obj, key_obj>::has_sample(uint64_t eqclass_id, uint64_t
+																						 sample) const {
+	uint64_t start_idx = (eqclass_id - 1);
+	uint64_t bucket_idx = start_idx / bv_buffer_rows;
+	if (!color_matrices.empty())
+		return color_matrices[bucket_idx].contains(start_idx % bv_buffer_rows,
+																							 sample);
+	return eqclasses[bucket_idx][(start_idx % bv_buffer_rows) * num_samples +
+		sample];
 }
 
 template <class qf_obj, class key_obj>
@@ -349,30 +718,20 @@ ColoredDbg<qf_obj,key_obj>::find_samples(const std::unordered_map<mantis::KmerHa
 	std::unordered_map<uint64_t, std::vector<uint64_t>> query_eqclass_map;
 	for (auto kv : uniqueKmers) {
 		key_obj key(kv.first, 0, 0);
-		uint64_t eqclass = dbg.query(key, 0);
+		uint64_t eqclass = query_dbg(key);
 		if (eqclass) {
 		    kv.second = eqclass;
             query_eqclass_map[eqclass] = std::vector<uint64_t>();
         }
 	}
 
-	std::vector<uint64_t> sample_map(num_samples, 0);
 	for (auto it = query_eqclass_map.begin(); it != query_eqclass_map.end();
 		 ++it) {
 		auto eqclass_id = it->first;
 		auto &vec = it->second;
-		// counter starts from 1.
-		uint64_t start_idx = (eqclass_id - 1);
-		uint64_t bucket_idx = start_idx / mantis::NUM_BV_BUFFER;
-		uint64_t bucket_offset = (start_idx % mantis::NUM_BV_BUFFER) * num_samples;
-		for (uint32_t w = 0; w <= num_samples / 64; w++) {
-			uint64_t len = std::min((uint64_t)64, num_samples - w * 64);
-			uint64_t wrd = eqclasses[bucket_idx].get_int(bucket_offset, len);
-			for (uint32_t i = 0, sCntr = w * 64; i < len; i++, sCntr++)
-				if ((wrd >> i) & 0x01)
-					vec.push_back(sCntr);
-			bucket_offset += len;
-		}
+		for_each_sample(eqclass_id, [&](uint64_t sample) {
+			vec.push_back(sample);
+		});
 	}
 	return query_eqclass_map;
 }
@@ -381,78 +740,42 @@ template <class qf_obj, class key_obj>
 cdbg_bv_map_t<__uint128_t, std::pair<uint64_t, uint64_t>>& ColoredDbg<qf_obj,
 	key_obj>::construct(qf_obj *incqfs, uint64_t num_kmers)
 {
-	uint64_t counter = 0;
 	bool is_sampling = (num_kmers < std::numeric_limits<uint64_t>::max());
+	MergeHeap minheap;
 
-	struct Iterator {
-		QFi qfi;
-		typename key_obj::kmer_t kmer;
-		uint32_t id;
-		bool do_madvice{false};
-		Iterator(uint32_t id, const QF* cqf, bool flag): id(id), do_madvice(flag)
-		{
-			if (qf_iterator_from_position(cqf, &qfi, 0) != QFI_INVALID) {
-				get_key();
-        if (do_madvice)
-          qfi_initial_madvise(&qfi);
-      }
-		}
-		bool next() {
-			if (do_madvice) {
-				if (qfi_next_madvise(&qfi) == QFI_INVALID) return false;
-			} else {
-				if (qfi_next(&qfi) == QFI_INVALID) return false;
-			}
-			get_key();
-			return true;
-		}
-		bool end() const {
-			return qfi_end(&qfi);
-		}
-		bool operator>(const Iterator& rhs) const {
-			return key() > rhs.key();
-		}
-		const typename key_obj::kmer_t& key() const { return kmer; }
-		private:
-		void get_key() {
-			uint64_t value, count;
-			qfi_get_hash(&qfi, &kmer, &value, &count);
-		}
-	};
+	// edges of the color graph are only collected in the final merge
+	if (collect_mst_edges && !is_sampling) {
+		mst_edge_file.open(get_mst_edge_file(), std::ios::out | std::ios::binary);
+		mst_edge_file.write(reinterpret_cast<const char*>(&num_mst_edges),
+												sizeof(num_mst_edges));
+	}
 
-  typename CQF<key_obj>::Iterator walk_behind_iterator;
-  
-	struct Minheap_PQ {
-		void push(const Iterator& obj) {
-			c.emplace_back(obj);
-			std::push_heap(c.begin(), c.end(), std::greater<Iterator>());
-		}
-		void pop() {
-			std::pop_heap(c.begin(), c.end(), std::greater<Iterator>());
-			c.pop_back();
-		}
-		void replace_top(const Iterator& obj) {
-			c.emplace_back(obj);
-			pop();
-		}
-		Iterator& top() { return c.front(); }
-		bool empty() const { return c.empty(); }
-		private:
-		std::vector<Iterator> c;
-	};
-	Minheap_PQ minheap;
+	// the final merge can run on several threads, unless the color graph edges
+	// are collected, which needs the k-mers to be inserted in order
+	bool parallel = !is_sampling && num_threads > 1 && !mst_edge_file.is_open();
+
+	// the budget is shared by the iterators of all the inputs, one per thread
+	uint64_t num_iterators = num_samples * (parallel ? num_threads : 1);
+	uint64_t readahead = readahead_budget / num_iterators;
+	for (uint32_t i = 0; i < num_samples; i++)
+		incqfs[i].obj->set_readahead(readahead);
+
+	if (parallel) {
+		construct_parallel(incqfs);
+		return eqclass_map;
+	}
 
 	for (uint32_t i = 0; i < num_samples; i++) {
-		Iterator qfi(i, incqfs[i].obj->get_cqf(), true);
+		MergeIterator qfi(i, incqfs[i].obj->get_cqf(), true);
 		if (qfi.end()) continue;
 		minheap.push(qfi);
 	}
 
-	while (!minheap.empty()) {
-		BitVector eq_class(num_samples);
-		KeyObject::kmer_t last_key;
+	merge_kmers([&](typename key_obj::kmer_t& last_key, BitVector& eq_class) {
+		if (minheap.empty())
+			return false;
 		do {
-			Iterator& cur = minheap.top();
+			MergeIterator& cur = minheap.top();
 			last_key = cur.key();
 			eq_class[cur.id] = 1;
 			if (cur.next())
@@ -460,6 +783,59 @@ cdbg_bv_map_t<__uint128_t, std::pair<uint64_t, uint64_t>>& ColoredDbg<qf_obj,
 			else
 				minheap.pop();
 		} while(!minheap.empty() && last_key == minheap.top().key());
+		return true;
+	}, num_kmers);
+	return eqclass_map;
+}
+
+/*
+ * Merge of the hierarchical build: the k-mers come from the color runs of the
+ * groups of samples rather than from the input CQFs (see colorRuns.h).
+ */
+template <class qf_obj, class key_obj>
+cdbg_bv_map_t<__uint128_t, std::pair<uint64_t, uint64_t>>& ColoredDbg<qf_obj,
+	key_obj>::construct(const std::vector<std::string>& run_files, uint64_t
+											num_kmers)
+{
+	bool is_sampling = (num_kmers < std::numeric_limits<uint64_t>::max());
+	if (collect_mst_edges && !is_sampling) {
+		mst_edge_file.open(get_mst_edge_file(), std::ios::out | std::ios::binary);
+		mst_edge_file.write(reinterpret_cast<const char*>(&num_mst_edges),
+												sizeof(num_mst_edges));
+	}
+
+	ColorRunMerger runs(run_files);
+	if (runs.samples() != num_samples) {
+		console->error("The color runs have {} samples. Expected: {}",
+									 runs.samples(), num_samples);
+		exit(1);
+	}
+	merge_kmers([&](typename key_obj::kmer_t& key, BitVector& eq_class) {
+		return runs.next(key, eq_class);
+	}, num_kmers);
+	return eqclass_map;
+}
+
+/*
+ * Adds the k-mers yielded in increasing hash order by next_kmer(key, eq_class)
+ * to the dbg, next_kmer returns false after the last one. The sampling phase
+ * (num_kmers < max) stops after num_kmers k-mers or when the bit vector buffer
+ * is full.
+ */
+template <class qf_obj, class key_obj>
+template <class NextKmer>
+void ColoredDbg<qf_obj, key_obj>::merge_kmers(NextKmer next_kmer, uint64_t
+																							num_kmers)
+{
+	uint64_t counter = 0;
+	bool is_sampling = (num_kmers < std::numeric_limits<uint64_t>::max());
+
+  typename CQF<key_obj>::Iterator walk_behind_iterator;
+	while (true) {
+		BitVector eq_class(num_samples);
+		typename key_obj::kmer_t last_key;
+		if (!next_kmer(last_key, eq_class))
+			break;
 		bool added_eq_class = add_kmer(last_key, eq_class);
 		++counter;
 
@@ -480,7 +856,7 @@ cdbg_bv_map_t<__uint128_t, std::pair<uint64_t, uint64_t>>& ColoredDbg<qf_obj,
 		}
 
 		// Check if the bit vector buffer is full and needs to be serialized.
-		if (added_eq_class and (get_num_eqclasses() % mantis::NUM_BV_BUFFER == 0))
+		if (added_eq_class and (get_num_eqclasses() % bv_buffer_rows == 0))
 		{
 			// Check if the process is in the sampling phase.
 			if (is_sampling) {
@@ -495,10 +871,227 @@ cdbg_bv_map_t<__uint128_t, std::pair<uint64_t, uint64_t>>& ColoredDbg<qf_obj,
 			// Check if the sampling phase is finished based on the number of k-mers.
 			break;
 		}
+	}
+}
+
+/*
+ * Final merge on num_threads threads, each one over its own range of hashes.
+ * The threads first merge their ranges, numbering the eq classes they find in
+ * the order they see them, and write the merged k-mers to a temporary file.
+ * The eq classes then get their ids range after range, in that order, which
+ * gives every eq class the id the single-threaded merge would. Finally the
+ * threads insert the k-mers of their ranges into the shared dbg with
+ * qf_insert, which takes the CQF region locks, so they only meet on the locks
+ * at the borders of their ranges.
+ */
+template <class qf_obj, class key_obj>
+void ColoredDbg<qf_obj, key_obj>::construct_parallel(qf_obj *incqfs) {
+	console->info("Merging with {} threads.", num_threads);
+	__uint128_t range = dbg.range();
+	std::vector<MergeRange> ranges(num_threads);
+	std::vector<std::thread> threads;
+	for (uint32_t t = 0; t < num_threads; t++) {
+		uint64_t start_hash = static_cast<uint64_t>(t * range / num_threads);
+		__uint128_t end_hash = (t + 1) * range / num_threads;
+		ranges[t].kmer_file = prefix + std::to_string(t) + "_" +
+			mantis::MERGE_KMERS_TMP_FILE;
+		ranges[t].class_file = prefix + std::to_string(t) + "_" +
+			mantis::MERGE_CLASSES_TMP_FILE;
+		threads.emplace_back(&ColoredDbg<qf_obj, key_obj>::merge_range, this,
+												 incqfs, start_hash, end_hash, std::ref(ranges[t]));
+	}
+	for (auto& t : threads)
+		t.join();
+	threads.clear();
+
+	for (auto& r : ranges)
+		assign_eq_ids(r);
+	console->info("Merged {} kmers into {} eq classes. Total time: {}",
+								num_kmers_merged.load(), get_num_eqclasses(),
+								time(nullptr) - start_time_);
+
+	// resizing is coordinated between the threads (see insert_kmer)
+	dbg.set_auto_resize(false);
+	for (auto& r : ranges)
+		threads.emplace_back(&ColoredDbg<qf_obj, key_obj>::insert_range, this,
+												 std::ref(r));
+	for (auto& t : threads)
+		t.join();
+	dbg.set_auto_resize(true);
 
-		//while(!minheap.empty() && minheap.top().end()) minheap.pop();
+	uint64_t locks_taken, single_attempt, time_single, time_spinning;
+	if (qf_get_lock_stats(dbg.get_cqf(), &locks_taken, &single_attempt,
+												&time_single, &time_spinning)) {
+		console->info("CQF locks (since the last resize): {} taken, {} contended, "
+									"{:.3f}s acquiring, {:.3f}s spinning", locks_taken,
+									locks_taken - single_attempt, time_single / 1e9,
+									time_spinning / 1e9);
+	}
+}
+
+/* Merges the k-mers of the range [start_hash, end_hash) of hashes. eqclass_map
+ * only holds the eq classes of the sampling phase, and is not modified until
+ * all the ranges are merged.
+ */
+template <class qf_obj, class key_obj>
+void ColoredDbg<qf_obj, key_obj>::merge_range(qf_obj *incqfs, uint64_t
+																							start_hash, __uint128_t
+																							end_hash, MergeRange& range) {
+	MergeHeap minheap;
+	for (uint32_t i = 0; i < num_samples; i++) {
+		MergeIterator qfi(i, incqfs[i].obj->get_cqf(), start_hash, true);
+		if (qfi.end() || qfi.key() >= end_hash) continue;
+		minheap.push(qfi);
+	}
+
+	std::ofstream kmer_file(range.kmer_file, std::ios::out | std::ios::binary);
+	std::ofstream class_file(range.class_file, std::ios::out | std::ios::binary);
+	// vector hash -> index in range.classes
+	cdbg_bv_map_t<__uint128_t, uint64_t> local_map;
+	while (!minheap.empty()) {
+		BitVector eq_class(num_samples);
+		KeyObject::kmer_t last_key;
+		do {
+			MergeIterator& cur = minheap.top();
+			last_key = cur.key();
+			eq_class[cur.id] = 1;
+			if (cur.next() && cur.key() < end_hash)
+				minheap.replace_top(cur);
+			else
+				minheap.pop();
+		} while(!minheap.empty() && last_key == minheap.top().key());
+
+		__uint128_t vec_hash = MurmurHash128A((void*)eq_class.data(),
+																					eq_class.capacity()/8, 2038074743,
+																					2038074751);
+		auto it = local_map.find(vec_hash);
+		if (it == local_map.end()) {
+			auto sampled = eqclass_map.find(vec_hash);
+			uint64_t eq_id = sampled == eqclass_map.end() ? 0 : sampled->second.first;
+			if (eq_id == 0)
+				class_file.write(reinterpret_cast<const char*>(eq_class.data()),
+												 eq_class.capacity()/8);
+			it = local_map.emplace(vec_hash, range.classes.size()).first;
+			range.classes.push_back({vec_hash, 0, eq_id});
+		}
+		uint64_t local_id = it->second;
+		range.classes[local_id].abundance++;
+		kmer_file.write(reinterpret_cast<const char*>(&last_key), sizeof(last_key));
+		kmer_file.write(reinterpret_cast<const char*>(&local_id), sizeof(local_id));
+
+		// Progress tracker
+		uint64_t merged = ++num_kmers_merged;
+		if (merged % 10000000 == 0)
+			console->info("Kmers merged: {}  Total time: {}", merged,
+										time(nullptr) - start_time_);
+	}
+	if (!kmer_file || !class_file) {
+		console->error("Could not write the merged k-mers to {}", range.kmer_file);
+		exit(1);
 	}
-	return eqclass_map;
+}
+
+/* Gives ids to the eq classes of a merged range, after those of the ranges
+ * before it, and adds up their abundances.
+ */
+template <class qf_obj, class key_obj>
+void ColoredDbg<qf_obj, key_obj>::assign_eq_ids(MergeRange& range) {
+	std::ifstream class_file(range.class_file, std::ios::in | std::ios::binary);
+	BitVector eq_class(num_samples);
+	for (auto& c : range.classes) {
+		if (c.eq_id) {
+			eqclass_map[c.vec_hash].second += c.abundance;
+			continue;
+		}
+		if (!class_file.read(reinterpret_cast<char*>(eq_class.data()),
+												 eq_class.capacity()/8)) {
+			console->error("Could not read the eq classes from {}", range.class_file);
+			exit(1);
+		}
+		bool added_eq_class{false};
+		c.eq_id = get_eq_class(eq_class, c.vec_hash, c.abundance, added_eq_class);
+		if (added_eq_class && get_num_eqclasses() % bv_buffer_rows == 0) {
+			console->info("Serializing bit vector with {} eq classes.",
+										get_num_eqclasses());
+			bv_buffer_serialize();
+		}
+	}
+	class_file.close();
+	std::remove(range.class_file.c_str());
+}
+
+/* Inserts the k-mers of a merged range into the dbg with their eq class ids. */
+template <class qf_obj, class key_obj>
+void ColoredDbg<qf_obj, key_obj>::insert_range(MergeRange& range) {
+	std::ifstream kmer_file(range.kmer_file, std::ios::in | std::ios::binary);
+	std::shared_lock<std::shared_mutex> dbg_lock(dbg_resize_mutex);
+	typename key_obj::kmer_t key;
+	uint64_t local_id;
+	while (kmer_file.read(reinterpret_cast<char*>(&key), sizeof(key)) &&
+				 kmer_file.read(reinterpret_cast<char*>(&local_id), sizeof(local_id))) {
+		insert_kmer(key, range.classes[local_id].eq_id, dbg_lock);
+		if (resize_requests.load(std::memory_order_relaxed))
+			wait_for_resize(dbg_lock);
+	}
+	dbg_lock.unlock();
+	kmer_file.close();
+	std::remove(range.kmer_file.c_str());
+}
+
+/* Inserts a k-mer during the parallel merge, with dbg_lock held shared.
+ * Auto resize is off, so a full dbg shows up as QF_NO_SPACE. The thread then
+ * releases its shared lock and takes dbg_resize_mutex exclusively, once all
+ * the other threads have parked in wait_for_resize, and doubles the dbg
+ * unless another thread already did.
+ */
+template <class qf_obj, class key_obj>
+void ColoredDbg<qf_obj, key_obj>::insert_kmer(const typename
+																							key_obj::kmer_t& hash, uint64_t
+																							eq_id,
+																							std::shared_lock<std::shared_mutex>&
+																							dbg_lock) {
+	while (true) {
+		uint64_t nslots = dbg.numslots();
+		// we use the count to store the eqclass ids
+		int ret = dbg.insert(KeyObject(hash, 0, eq_id), QF_WAIT_FOR_LOCK |
+												 QF_KEY_IS_HASH);
+		if (ret >= 0)
+			return;
+		if (ret != QF_NO_SPACE) {
+			console->error("Inserting kmer {} in the CQF failed ({}).", hash, ret);
+			exit(1);
+		}
+
+		resize_requests++;
+		dbg_lock.unlock();
+		{
+			std::unique_lock<std::shared_mutex> resize_lock(dbg_resize_mutex);
+			if (dbg.numslots() == nslots) {
+				console->info("Resizing the CQF to {} slots.", 2 * nslots);
+				if (dbg.resize(2 * nslots) < 0) {
+					console->error("The CQF is full and resize failed. Please rerun build with a bigger size.");
+					exit(1);
+				}
+			}
+		}
+		resize_requests--;
+		wait_for_resize(dbg_lock);
+		// the insert also fails after adding the k-mer when it landed too far
+		// from its home slot
+		if (dbg.query(KeyObject(hash, 0, 0), QF_NO_LOCK | QF_KEY_IS_HASH))
+			return;
+	}
+}
+
+/* Releases the shared lock on the dbg until all pending resizes are done. */
+template <class qf_obj, class key_obj>
+void ColoredDbg<qf_obj, key_obj>::wait_for_resize(std::shared_lock<std::shared_mutex>&
+																									dbg_lock) {
+	if (dbg_lock.owns_lock())
+		dbg_lock.unlock();
+	while (resize_requests.load())
+		std::this_thread::yield();
+	dbg_lock.lock();
 }
 
 template <class qf_obj, class key_obj>
@@ -514,7 +1107,7 @@ ColoredDbg<qf_obj, key_obj>::ColoredDbg(uint64_t qbits, uint64_t key_bits,
 																				enum qf_hashmode hashmode,
 																				uint32_t seed, std::string& prefix,
 																				uint64_t nqf, int flag) :
-	bv_buffer(mantis::NUM_BV_BUFFER * nqf), prefix(prefix), num_samples(nqf),
+	bv_buffer(), prefix(prefix), num_samples(nqf),
 	num_serializations(0), start_time_(std::time(nullptr)) {
 		if (flag == MANTIS_DBG_IN_MEMORY) {
 			CQF<key_obj> cqf(qbits, key_bits, hashmode, seed);
@@ -550,6 +1143,12 @@ ColoredDbg<qf_obj, key_obj>::ColoredDbg(std::string& cqf_file,
 			CQF<key_obj>cqf(cqf_file, CQF_MMAP);
 			dbg = cqf;
 			dbg_alloc_flag = MANTIS_DBG_ON_DISK;
+		} else if (flag == MANTIS_DBG_STATIC_MAP) {
+			if (!static_dbg.load(cqf_file)) {
+				ERROR("Can't read the static k-mer map");
+				exit(EXIT_FAILURE);
+			}
+			dbg_alloc_flag = MANTIS_DBG_STATIC_MAP;
 		} else {
 			ERROR("Wrong Mantis alloc mode.");
 			exit(EXIT_FAILURE);
@@ -561,11 +1160,22 @@ ColoredDbg<qf_obj, key_obj>::ColoredDbg(std::string& cqf_file,
 			sorted_files[id] = file;
 		}
 
-		eqclasses.reserve(sorted_files.size());
+		std::string matrix_suffix(mantis::COLOR_MATRIX_FILE);
 		BitVectorRRR bv;
 		for (auto file : sorted_files) {
-			sdsl::load_from_file(bv, file.second);
-			eqclasses.push_back(bv);
+			// index built with --color-matrix
+			if (file.second.size() >= matrix_suffix.size() &&
+					file.second.compare(file.second.size() - matrix_suffix.size(),
+															matrix_suffix.size(), matrix_suffix) == 0) {
+				color_matrices.emplace_back();
+				if (!color_matrices.back().load(file.second)) {
+					ERROR("Can't read the color matrix " << file.second);
+					exit(EXIT_FAILURE);
+				}
+			} else {
+				sdsl::load_from_file(bv, file.second);
+				eqclasses.push_back(bv);
+			}
 			num_serializations++;
 		}
 
@@ -578,6 +1188,13 @@ ColoredDbg<qf_obj, key_obj>::ColoredDbg(std::string& cqf_file,
 			num_samples++;
 		}
 		sampleid.close();
+
+		// every file but the last one holds a full buffer of eq classes
+		if (!eqclasses.empty() && num_samples)
+			bv_buffer_rows = eqclasses[0].size() / num_samples;
+		else if (!color_matrices.empty())
+			bv_buffer_rows = color_matrices[0].rows();
+		bv_buffer_rows = std::max(bv_buffer_rows, (uint64_t)1);
 }
 
 #endif
@@ -1,10 +1,14 @@
 #ifndef __MANTIS_COMMON_TYPES__
 #define __MANTIS_COMMON_TYPES__
 
+#include <algorithm>
+#include <functional>
 #include <unordered_set>
 #include <unordered_map>
 #include <vector>
 
+#include "mantisconfig.hpp"
+
 namespace mantis {
   using KmerHash = uint64_t;
   using ExperimentID = uint64_t;
@@ -18,7 +22,215 @@ namespace mantis {
   };
 
 
-  using QueryResult = std::vector<uint64_t>;//std::unordered_map<uint64_t, uint64_t>;
+  /**
+   * Number of query k-mers in each sample, for one query at a time.
+   * The counts live in an array over all the samples that is kept for the next
+   * query, and the samples hit are listed while they are few, so that neither
+   * clearing nor reading a result that hits a handful of samples scans all of
+   * them. Past 1/DENSE_RESULT_DIVISOR of the samples the list is dropped and the
+   * array is scanned instead.
+   */
+  class QueryResult {
+    public:
+      QueryResult() = default;
+      explicit QueryResult(uint64_t numSamples) : counts(numSamples, 0) {}
+
+      uint64_t size() const { return counts.size(); }
+      uint64_t operator[](uint64_t sample) const { return counts[sample]; }
+
+      // count must be > 0
+      void add(uint64_t sample, uint64_t count) {
+        if (!dense && !counts[sample]) {
+          hits.push_back(sample);
+          dense = hits.size() > counts.size() / DENSE_RESULT_DIVISOR;
+        }
+        counts[sample] += count;
+        if (tracked)
+          track(sample);
+      }
+
+      // keeps the samples with the k largest counts in a min-heap as the counts
+      // grow, so that kth_largest(k) is its top, until the next clear. The
+      // result must be empty
+      void track_largest(uint64_t k) {
+        tracked = k;
+        if (k && heap_pos.size() != counts.size())
+          heap_pos.assign(counts.size(), NOT_IN_HEAP);
+      }
+
+      // calls fn(sample, count) for the samples with a nonzero count, in
+      // increasing order of sample id
+      template <class F>
+      void for_each_hit(F fn) {
+        if (dense) {
+          for (uint64_t i = 0; i < counts.size(); ++i)
+            if (counts[i])
+              fn(i, counts[i]);
+        } else {
+          std::sort(hits.begin(), hits.end());
+          for (auto sample : hits)
+            fn(sample, counts[sample]);
+        }
+      }
+
+      // zeroes the counts below min
+      void keep_at_least(uint64_t min) {
+        if (dense) {
+          for (auto &count : counts)
+            if (count < min)
+              count = 0;
+        } else {
+          uint64_t kept = 0;
+          for (auto sample : hits) {
+            if (counts[sample] < min)
+              counts[sample] = 0;
+            else
+              hits[kept++] = sample;
+          }
+          hits.resize(kept);
+        }
+      }
+
+      // the k-th largest count, 0 if fewer than k samples are hit
+      uint64_t kth_largest(uint64_t k) {
+        if (k == tracked)
+          return heap.size() < k ? 0 : counts[heap.front()];
+        // min-heap of the k largest counts
+        largest.clear();
+        auto push = [&](uint64_t count) {
+          if (largest.size() < k) {
+            largest.push_back(count);
+            std::push_heap(largest.begin(), largest.end(), std::greater<uint64_t>());
+          } else if (count > largest.front()) {
+            std::pop_heap(largest.begin(), largest.end(), std::greater<uint64_t>());
+            largest.back() = count;
+            std::push_heap(largest.begin(), largest.end(), std::greater<uint64_t>());
+          }
+        };
+        if (dense) {
+          for (auto count : counts)
+            if (count)
+              push(count);
+        } else {
+          for (auto sample : hits)
+            push(counts[sample]);
+        }
+        return largest.size() < k ? 0 : largest.front();
+      }
+
+      // zeroes the counts of all but the k samples with the largest counts,
+      // keeping the smallest sample ids among equal counts
+      void keep_top(uint64_t k) {
+        uint64_t kth = kth_largest(k);
+        if (!kth)
+          return;
+        uint64_t ties = k;
+        if (k == tracked)
+          for (auto sample : heap)
+            ties -= counts[sample] > kth;
+        else
+          for (auto count : largest)
+            ties -= count > kth;
+        keep_at_least(kth);
+        auto keep = [&](uint64_t sample) {
+          if (counts[sample] == kth) {
+            if (!ties) {
+              counts[sample] = 0;
+              return false;
+            }
+            --ties;
+          }
+          return true;
+        };
+        if (dense) {
+          for (uint64_t i = 0; i < counts.size(); ++i)
+            if (counts[i])
+              keep(i);
+        } else {
+          std::sort(hits.begin(), hits.end());
+          uint64_t kept = 0;
+          for (auto sample : hits)
+            if (keep(sample))
+              hits[kept++] = sample;
+          hits.resize(kept);
+        }
+      }
+
+      // zeroes the counts for the next query
+      void clear() {
+        if (dense)
+          std::fill(counts.begin(), counts.end(), 0);
+        else
+          for (auto sample : hits)
+            counts[sample] = 0;
+        hits.clear();
+        dense = false;
+        for (auto sample : heap)
+          heap_pos[sample] = NOT_IN_HEAP;
+        heap.clear();
+        tracked = 0;
+      }
+
+    private:
+      static constexpr uint64_t NOT_IN_HEAP{UINT64_MAX};
+
+      bool heap_less(uint64_t i, uint64_t j) const {
+        return counts[heap[i]] < counts[heap[j]];
+      }
+
+      void heap_swap(uint64_t i, uint64_t j) {
+        std::swap(heap[i], heap[j]);
+        heap_pos[heap[i]] = i;
+        heap_pos[heap[j]] = j;
+      }
+
+      void sift_down(uint64_t i) {
+        while (true) {
+          uint64_t min = i, l = 2 * i + 1, r = l + 1;
+          if (l < heap.size() && heap_less(l, min))
+            min = l;
+          if (r < heap.size() && heap_less(r, min))
+            min = r;
+          if (min == i)
+            return;
+          heap_swap(i, min);
+          i = min;
+        }
+      }
+
+      // the count of sample just grew: it moves down the heap if it's in it,
+      // and otherwise takes the place of the smallest count if it's now larger
+      void track(uint64_t sample) {
+        uint64_t pos = heap_pos[sample];
+        if (pos != NOT_IN_HEAP) {
+          sift_down(pos);
+        } else if (heap.size() < tracked) {
+          heap.push_back(sample);
+          uint64_t i = heap.size() - 1;
+          heap_pos[sample] = i;
+          while (i && heap_less(i, (i - 1) / 2)) {
+            heap_swap(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+          }
+        } else if (counts[sample] > counts[heap.front()]) {
+          heap_pos[heap.front()] = NOT_IN_HEAP;
+          heap.front() = sample;
+          heap_pos[sample] = 0;
+          sift_down(0);
+        }
+      }
+
+      std::vector<uint64_t> counts;
+      std::vector<uint64_t> hits;
+      // scratch space of kth_largest
+      std::vector<uint64_t> largest;
+      bool dense{false};
+      // with track_largest: the samples with the tracked largest counts, by
+      // count, and the position of each sample in heap
+      uint64_t tracked{0};
+      std::vector<uint64_t> heap;
+      std::vector<uint64_t> heap_pos;
+  };
   using QueryResults = std::vector<QueryResult>;
 }
 
@@ -0,0 +1,48 @@
+#ifndef MANTIS_DBGCOLORIDS_H
+#define MANTIS_DBGCOLORIDS_H
+
+#include <cstdint>
+
+#include "gqf_cpp.h"
+
+/**
+ * The color class ids of the k-mers of the dbg CQF, in either of its layouts.
+ * mantis build stores the color class id + 1 of each k-mer as its count. With
+ * --pack-color-ids (see ColoredDbg::pack_dbg) the dbg has value bits, and each
+ * k-mer is inserted once with its color class id as its value.
+ * These return the id + 1 (the eq class), 0 meaning the k-mer is not in the dbg.
+ */
+
+// the eq class of the k-mer k
+template <class key_obj>
+uint64_t dbg_eqclass(CQF<key_obj> &dbg, const key_obj &k, uint8_t flags) {
+    if (dbg.valuebits() == 0) {
+        return dbg.query(k, flags);
+    }
+    // the k-mer is in a single slot, and its value is masked out rather than
+    // branched on when it's absent
+    uint64_t value = 0;
+    uint64_t found = dbg.query_value(k, &value, flags);
+    return (value + 1) & -static_cast<uint64_t>(found != 0);
+}
+
+// the eq class of the k-mer an iterator over the dbg points to
+template <class key_obj>
+uint64_t dbg_eqclass(const CQF<key_obj> &dbg, const key_obj &entry) {
+    return dbg.valuebits() == 0 ? entry.count : entry.value + 1;
+}
+
+// the index of the k-mer k in the dbg (see qf_get_unique_index)
+template <class key_obj>
+int64_t dbg_unique_index(const CQF<key_obj> &dbg, const key_obj &k, uint8_t flags) {
+    if (dbg.valuebits() == 0) {
+        return dbg.get_unique_index(k, flags);
+    }
+    uint64_t value = 0;
+    if (!dbg.query_value(k, &value, flags)) {
+        return QF_DOESNT_EXIST;
+    }
+    return dbg.get_unique_index(key_obj(k.key, value, 0), flags);
+}
+
+#endif //MANTIS_DBGCOLORIDS_H
@@ -46,6 +46,13 @@ extern "C" {
 		QF_HASH_NONE
 	};
 
+	/* Pages backing the memory of a CQF (see qf_set_hugepages). */
+	enum qf_page_kind {
+		QF_PAGES_DEFAULT,
+		QF_PAGES_HUGETLB,
+		QF_PAGES_TRANSPARENT
+	};
+
 	/* The CQF supports concurrent insertions and queries.  Only the
 		 portion of the CQF being examined or modified is locked, so it
 		 supports high throughput even with many threads.
@@ -126,6 +133,18 @@ extern "C" {
 		 function. */
 	void qf_set_auto_resize(QF* qf, bool enabled);
 
+	/* Back the CQFs that are allocated in memory from now on (qf_malloc,
+	 * qf_resize_malloc and qf_deserialize) with huge pages. Reserved hugetlb
+	 * pages (MAP_HUGETLB) are used if there are enough of them, otherwise
+	 * transparent huge pages are requested with madvise(MADV_HUGEPAGE).
+	 * File-backed CQFs are not affected. */
+	void qf_set_hugepages(bool enabled);
+
+	/* Returns the kind of pages the memory of the CQF was allocated with.
+	 * For QF_PAGES_HUGETLB, *page_size is set to the huge page size. With
+	 * QF_PAGES_TRANSPARENT the kernel decides which parts get huge pages. */
+	enum qf_page_kind qf_get_page_kind(const QF *qf, uint64_t *page_size);
+
 	/***********************************
    Functions for modifying the CQF.
 	***********************************/
@@ -144,6 +163,20 @@ extern "C" {
 	int qf_insert(QF *qf, uint64_t key, uint64_t value, uint64_t count, uint8_t
 								flags);
 
+#define QF_NOT_SORTED (-6)
+
+	/* Append this key/value pair with the given count, where the pair hashes to
+	 * a value strictly greater than every pair already in the CQF. Slots,
+	 * runends and offsets are written left to right without searching or
+	 * shifting, so building a CQF from keys in increasing hash order is a
+	 * linear write. Not thread-safe: flags only select whether the key is
+	 * already a hash.
+	 * Return value: Same as qf_insert, or
+	 *    == QF_NOT_SORTED: the pair does not hash past the current maximum.
+	 */
+	int qf_append_sorted(QF *qf, uint64_t key, uint64_t value, uint64_t count,
+											 uint8_t flags);
+
 	/* Set the counter for this key/value pair to count. 
 	 Return value: Same as qf_insert. 
 	 Returns 0 if new count is equal to old count.
@@ -226,6 +259,15 @@ extern "C" {
 	uint64_t qf_get_nslots(const QF *qf);
 	uint64_t qf_get_num_occupied_slots(const QF *qf);
 
+	/* Lock statistics summed over the lock regions (from the wait_time_data of
+	 * each region): locks taken, locks acquired on the first attempt, and the
+	 * time in ns spent acquiring locks on the first attempt and spinning.
+	 * Only collected when compiled with LOG_WAIT_TIME, returns false otherwise.
+	 */
+	bool qf_get_lock_stats(const QF *qf, uint64_t *locks_taken, uint64_t
+												 *single_attempt, uint64_t *time_single, uint64_t
+												 *time_spinning);
+
 	/* Bit-sizes info. */
 	uint64_t qf_get_num_key_bits(const QF *qf);
 	uint64_t qf_get_num_value_bits(const QF *qf);
@@ -57,6 +57,12 @@ extern "C" {
      qfi to call madvise(DONTNEED) on the portion of the cqf up to the
      first element visited by the qfi. */
   int qfi_initial_madvise(QFi *qfi);
+
+  /* Makes qfi_next_madvise and qfi_initial_madvise also ask the kernel
+     (madvise(WILLNEED)) to read the file up to "bytes" past the
+     iterator, so that the iterator doesn't block on page faults. 0
+     turns it off. Only valid on mmapped QFs. */
+  void qf_set_readahead(QF *qf, uint64_t bytes);
   
 #ifdef __cplusplus
 }
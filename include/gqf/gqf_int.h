@@ -85,6 +85,22 @@ extern "C" {
 		volatile int metadata_lock;
 		volatile int *locks;
 		wait_time_data *wait_times;
+		/* State of qf_append_sorted: the last bucket and remainder appended and
+		 * the first slot after the last run. Invalidated by other updates and
+		 * then recomputed from the table. */
+		bool append_valid;
+		bool append_empty;
+		uint64_t append_bucket;
+		uint64_t append_remainder;
+		uint64_t append_end;
+		/* Set by qf_alloc_buffer when the memory of the CQF was mmapped rather
+		 * than malloced (huge pages), so that qf_free can unmap it. */
+		uint64_t mapped_bytes;
+		enum qf_page_kind page_kind;
+		uint64_t page_size;
+		/* How far ahead of its cursor qfi_next_madvise has the file read (see
+		 * qf_set_readahead). */
+		uint64_t readahead_bytes;
 	} quotient_filter_runtime_data;
 
 	typedef quotient_filter_runtime_data qfruntime;
@@ -147,8 +163,15 @@ extern "C" {
 		uint16_t cur_length;
 		uint32_t num_clusters;
 		cluster_data *c_info;
+		/* Offset from the blocks up to which the file was read ahead. */
+		uint64_t readahead_end;
 	} quotient_filter_iterator;
 
+	/* Allocates the memory for a CQF of total_num_bytes, in huge pages if
+	 * qf_set_hugepages is on, and records in qf->runtimedata how it was
+	 * allocated. Returns NULL on failure. */
+	void *qf_alloc_buffer(QF *qf, uint64_t total_num_bytes);
+
 #ifdef __cplusplus
 }
 #endif
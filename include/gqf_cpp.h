@@ -42,6 +42,8 @@ class CQF {
 				seed);
 		CQF(uint64_t q_bits, uint64_t key_bits, enum qf_hashmode hash, uint32_t
 				seed, std::string filename);
+		CQF(uint64_t q_bits, uint64_t key_bits, uint64_t value_bits, enum
+				qf_hashmode hash, uint32_t seed, std::string filename);
 		CQF(std::string& filename, enum readmode flag);
 		CQF(const CQF<key_obj>& copy_cqf) = delete;
 
@@ -70,9 +72,19 @@ class CQF {
 
 		int insert(const key_obj& k, uint8_t flags);
 
+		/* Keys must be appended in increasing hash order (see qf_append_sorted). */
+		int append_sorted(const key_obj& k, uint8_t flags);
+
 		/* Will return the count. */
 		uint64_t query(const key_obj& k, uint8_t flags);
 
+		/* Will return the count of the key with the first value it is stored
+		 * with, and set value to that value. */
+		uint64_t query_value(const key_obj& k, uint64_t *value, uint8_t flags)
+			const {
+			return qf_query(&cqf, k.key, value, flags);
+		}
+
 		uint64_t inner_prod(const CQF<key_obj>& in_cqf);
 
 		void serialize(std::string filename) {
@@ -83,7 +95,15 @@ class CQF {
 		void close() { if (is_filebased) qf_closefile(&cqf); }
 		void delete_file() { if (is_filebased) qf_deletefile(&cqf); }
 
-		void set_auto_resize(void) { qf_set_auto_resize(&cqf, true); }
+		void set_auto_resize(bool enabled = true) {
+			qf_set_auto_resize(&cqf, enabled);
+		}
+		/* Bytes read ahead of the madvise iterators of a file-backed CQF. */
+		void set_readahead(uint64_t bytes) { qf_set_readahead(&cqf, bytes); }
+		/* Resizes the CQF to nslots slots, returns a negative value on failure. */
+		int64_t resize(uint64_t nslots) {
+			return cqf.runtimedata->container_resize(&cqf, nslots);
+		}
 		int64_t get_unique_index(const key_obj& k, uint8_t flags) const {
 			return qf_get_unique_index(&cqf, k.key, k.value, flags);
 		}
@@ -97,6 +117,9 @@ class CQF {
 		uint32_t seed(void) const { return cqf.metadata->seed; }
 		uint64_t numslots(void) const { return cqf.metadata->nslots; }
 		uint32_t keybits(void) const { return cqf.metadata->key_bits; }
+		uint32_t valuebits(void) const { return cqf.metadata->value_bits; }
+		uint64_t size_in_bytes(void) const { return
+			cqf.metadata->total_size_in_bytes; }
 		uint64_t total_elts(void) const { return qf_get_sum_of_counts(&cqf); }
 		uint64_t dist_elts(void) const { return
 			qf_get_num_distinct_key_value_pairs(&cqf); }
@@ -187,6 +210,17 @@ CQF<key_obj>::CQF(uint64_t q_bits, uint64_t key_bits, enum qf_hashmode hash,
 	is_filebased = true;
 }
 
+template <class key_obj>
+CQF<key_obj>::CQF(uint64_t q_bits, uint64_t key_bits, uint64_t value_bits, enum
+									qf_hashmode hash, uint32_t seed, std::string filename) {
+	if (!qf_initfile(&cqf, 1ULL << q_bits, key_bits, value_bits, hash, seed,
+									 filename.c_str())) {
+		ERROR("Can't allocate the CQF");
+		exit(EXIT_FAILURE);
+	}
+	is_filebased = true;
+}
+
 template <class key_obj>
 CQF<key_obj>::CQF(std::string& filename, enum readmode flag) {
 	uint64_t size = 0;
@@ -219,6 +253,11 @@ int CQF<key_obj>::insert(const key_obj& k, uint8_t flags) {
 	//set.insert(k.key);
 }
 
+template <class key_obj>
+int CQF<key_obj>::append_sorted(const key_obj& k, uint8_t flags) {
+	return qf_append_sorted(&cqf, k.key, k.value, k.count, flags);
+}
+
 template <class key_obj>
 uint64_t CQF<key_obj>::query(const key_obj& k, uint8_t flags) {
 	return qf_count_key_value(&cqf, k.key, k.value, flags);
@@ -0,0 +1,55 @@
+#ifndef MANTIS_HYPERLOGLOG_H
+#define MANTIS_HYPERLOGLOG_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mantisconfig.hpp"
+
+/**
+ * HyperLogLog sketch of the number of distinct 64-bit values added to it.
+ * The relative error of the estimate is about 1.04 / sqrt(2^precision).
+ */
+class HyperLogLog {
+public:
+    explicit HyperLogLog(uint32_t precision = mantis::HLL_PRECISION) :
+            precision(precision), registers(1ULL << precision, 0) {}
+
+    // the values are mixed first, so keys of any distribution can be added
+    void add(uint64_t value) {
+        value = mix(value);
+        uint64_t reg = value >> (64 - precision);
+        // a stop bit bounds the rank by 64 - precision + 1
+        uint64_t rest = (value << precision) | (1ULL << (precision - 1));
+        uint8_t rank = __builtin_clzll(rest) + 1;
+        if (rank > registers[reg]) {
+            registers[reg] = rank;
+        }
+    }
+
+    // sketch of the union, both must have the same precision
+    void merge(const HyperLogLog &other);
+
+    uint64_t estimate() const;
+
+private:
+    // finalizer of MurmurHash3
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    uint32_t precision;
+    std::vector<uint8_t> registers;
+};
+
+// estimates the number of distinct k-mers of the union of the CQFs, iterating
+// over their hashes with numThreads threads that each open one file at a time
+uint64_t estimateDistinctKmers(const std::vector<std::string> &cqfFiles, uint32_t numThreads);
+
+#endif //MANTIS_HYPERLOGLOG_H
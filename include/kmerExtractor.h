@@ -0,0 +1,71 @@
+#ifndef MANTIS_KMEREXTRACTOR_H
+#define MANTIS_KMEREXTRACTOR_H
+
+#include <cstdint>
+#include <vector>
+
+#include "kmer.h"
+
+/**
+ * Canonical k-mers (k <= 32) of DNA sequences, in the 2-bit encoding of DNA_MAP.
+ * The bases of a whole sequence are encoded in one pass, 16 at a time where SSE2 is
+ * available, and the forward and reverse complement k-mers are rolled over the codes.
+ * Any base other than A, C, G or T ends the current run of k-mers: no k-mer spans it,
+ * and the sequence is never copied.
+ * The canonical k-mer is the larger of the two, as in Kmer::compare_kmers.
+ */
+class KmerExtractor {
+public:
+    static constexpr uint8_t AMBIGUOUS = DNA_MAP::G + 1;
+
+    explicit KmerExtractor(uint64_t k);
+
+    uint64_t k() const { return kmerSize; }
+
+    // writes the code of each base of seq[0, len) to codes, AMBIGUOUS for the others
+    static void encode(const char *seq, uint64_t len, uint8_t *codes);
+
+    // calls fn(end, kmer) for every canonical k-mer of seq[0, len) in order,
+    // end being the position of its last base
+    template <class F>
+    void forEachKmer(const char *seq, uint64_t len, F fn);
+
+    // appends the canonical k-mers of seq[0, len) to kmers, returns how many were added
+    uint64_t extract(const char *seq, uint64_t len, std::vector<uint64_t> &kmers);
+
+private:
+    uint64_t kmerSize;
+    uint64_t mask;
+    // position of the first base of the k-mer in the reverse complement
+    uint64_t revShift;
+    // reused across sequences
+    std::vector<uint8_t> codes;
+};
+
+template <class F>
+void KmerExtractor::forEachKmer(const char *seq, uint64_t len, F fn) {
+    if (len < kmerSize) {
+        return;
+    }
+    if (codes.size() < len) {
+        codes.resize(len);
+    }
+    encode(seq, len, codes.data());
+    // bits of bases before the last ambiguous one are shifted out by the
+    // time kmerSize valid bases are seen
+    uint64_t fwd = 0, rev = 0, valid = 0;
+    for (uint64_t i = 0; i < len; ++i) {
+        uint64_t c = codes[i];
+        if (c == AMBIGUOUS) {
+            valid = 0;
+            continue;
+        }
+        fwd = ((fwd << 2) | c) & mask;
+        rev = (rev >> 2) | ((3 - c) << revShift);
+        if (++valid >= kmerSize) {
+            fn(i, fwd >= rev ? fwd : rev);
+        }
+    }
+}
+
+#endif //MANTIS_KMEREXTRACTOR_H
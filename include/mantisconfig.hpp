@@ -12,14 +12,66 @@ namespace mantis{
     constexpr char meta_file_name[] = "/meta_info.json";
     constexpr char CQF_FILE[] = "dbg_cqf.ser";
     constexpr char EQCLASS_FILE[] = "eqclass_rrr.cls";
+    // color classes written with mantis build --color-matrix instead of EQCLASS_FILE
+    constexpr char COLOR_MATRIX_FILE[] = "eqclass_cm.cls";
     constexpr char SAMPLEID_FILE[] = "sampleid.lst";
     constexpr char PARENTBV_FILE[] = "parents.bv";
     constexpr char DELTABV_FILE[] = "deltas.bv";
     constexpr char BOUNDARYBV_FILE[] = "boundaries.bv";
+    constexpr char DELTAVB_FILE[] = "deltas.vb";
+    constexpr char BOUNDARYVB_FILE[] = "boundaries.vb";
+    constexpr char MST_EDGES_TMP_FILE[] = "mst_edges.tmp";
+    // k-mers and new eq classes of each range of the parallel merge
+    constexpr char MERGE_KMERS_TMP_FILE[] = "merge_kmers.tmp";
+    constexpr char MERGE_CLASSES_TMP_FILE[] = "merge_classes.tmp";
+    constexpr char MST_EDGES_CKPT_FILE[] = "mst_edges.ckpt";
+    constexpr char MST_WEIGHTS_CKPT_FILE[] = "mst_weights.ckpt";
+    constexpr char MST_PARENTS_CKPT_FILE[] = "mst_parents.ckpt";
+    constexpr uint64_t MST_CKPT_MAGIC{0x6d73745f636b7074ULL};
+    constexpr uint32_t MST_CKPT_VERSION = 2;
+    constexpr char STATIC_MAP_FILE[] = "dbg_static.ser";
+    constexpr uint64_t STATIC_MAP_MAGIC{0x6d6e7469735f6d70ULL};
+    constexpr uint32_t STATIC_MAP_VERSION = 2;
+    // partial results of the hierarchical build: <prefix><level>_<group>.run
+    constexpr char COLOR_RUN_PREFIX[] = "colors_";
+    constexpr uint64_t COLOR_RUN_MAGIC{0x6d6e7469735f6372ULL};
+    constexpr uint32_t COLOR_RUN_VERSION = 1;
+    constexpr uint64_t COLOR_MATRIX_MAGIC{0x6d6e7469735f636dULL};
+    constexpr uint32_t COLOR_MATRIX_VERSION = 1;
+    // mantis query --binary output
+    constexpr uint64_t QUERY_RESULT_MAGIC{0x6d6e7469735f7172ULL};
+    constexpr uint32_t QUERY_RESULT_VERSION = 1;
+    // number of queries and hits in the header when the output can't be rewound to fill them in
+    constexpr uint64_t QUERY_RESULT_UNKNOWN_COUNT{UINT64_MAX};
+
+    // longest k-mers the dbg holds, as the 2k bits of a CQF key
+    constexpr uint32_t MAX_K{32};
+
+    // mantis build without -s: the output CQF is sized for the HyperLogLog estimate of
+    // the distinct input k-mers, each taking about OUTPUT_SLOTS_PER_KMER slots (its key
+    // and the counter holding its color class id), with some headroom for the error
+    constexpr uint32_t HLL_PRECISION{14};
+    constexpr double OUTPUT_SLOTS_PER_KMER{3.0};
+    constexpr double OUTPUT_SLOTS_HEADROOM{1.1};
 
     constexpr const uint64_t NUM_BV_BUFFER{20000000};
     constexpr const uint64_t INITIAL_EQ_CLASSES{10000};
     constexpr const uint64_t SAMPLE_SIZE{(1ULL << 26)};
+    // distinct color graph edges held in memory before they are written out
+    constexpr const uint64_t MST_EDGE_BUFFER_SIZE{31250000};
+    // edges written, or read back by MST::bucketEdges, at a time
+    constexpr const uint64_t MST_EDGE_IO_BATCH{(1ULL << 20)};
+    // default page cache budget for reading the input CQFs ahead during the merge
+    constexpr const uint64_t READAHEAD_BUDGET_MB{1024};
+    // a query result lists the samples it hits until more than 1/DENSE_RESULT_DIVISOR
+    // of them are, then it is read by scanning the counts of all the samples
+    constexpr const uint64_t DENSE_RESULT_DIVISOR{16};
+    // queries plus hits handed at once to the thread writing the query results, and
+    // bytes of formatted output it buffers before writing them
+    constexpr const uint64_t QUERY_WRITER_BATCH{(1ULL << 16)};
+    constexpr const uint64_t QUERY_WRITER_BUFFER{(1ULL << 20)};
+    // zlib mode of mantis query --gzip
+    constexpr char QUERY_GZIP_MODE[] = "wb1";
 } // namespace mantis
 
 #endif // __MANTIS_CONFIG_HPP__
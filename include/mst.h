@@ -5,6 +5,7 @@
 #ifndef MANTIS_MST_H
 #define MANTIS_MST_H
 
+#include <fstream>
 #include <set>
 #include <vector>
 #include <queue>
@@ -54,19 +55,6 @@ struct edge_hash {
     }
 };
 
-struct workItem {
-    dna::canonical_kmer node;
-    colorIdType colorId;
-
-    workItem(dna::canonical_kmer n, colorIdType c) : node(n), colorId(c) {}
-
-    // Required to be able to use it as a key in set
-    bool operator<(const workItem &item2) const {
-        return (*this).node < item2.node;
-    }
-};
-
-
 struct DisjointSetNode {
     colorIdType parent{0};
     uint64_t rnk{0}, w{0}, edges{0};
@@ -128,26 +116,114 @@ struct DisjointSets {
     }
 };
 
+/**
+ * Compressed (CSR) adjacency of the minimum spanning forest
+ * neighbors of node n are in neighbors[offsets[n] .. offsets[n+1])
+ * and the weight of the edge to neighbors[i] is weights[i]
+ */
+struct MSTAdjacency {
+    std::vector<uint64_t> offsets;
+    std::vector<colorIdType> neighbors;
+    std::vector<uint32_t> weights;
+
+    // builds the adjacency of numNodes nodes from the list of undirected edges
+    // and their weights (edgeWeights[i] is the weight of edges[i])
+    void build(uint64_t numNodes, const std::vector<Edge> &edges, const std::vector<uint32_t> &edgeWeights) {
+        offsets.assign(numNodes + 1, 0);
+        for (auto &e : edges) {
+            offsets[e.n1 + 1]++;
+            offsets[e.n2 + 1]++;
+        }
+        for (uint64_t i = 1; i <= numNodes; i++) {
+            offsets[i] += offsets[i - 1];
+        }
+        neighbors.resize(offsets[numNodes]);
+        weights.resize(offsets[numNodes]);
+        std::vector<uint64_t> nextSlot(offsets.begin(), offsets.end() - 1);
+        for (uint64_t i = 0; i < edges.size(); i++) {
+            auto &e = edges[i];
+            neighbors[nextSlot[e.n1]] = e.n2;
+            weights[nextSlot[e.n1]++] = edgeWeights[i];
+            neighbors[nextSlot[e.n2]] = e.n1;
+            weights[nextSlot[e.n2]++] = edgeWeights[i];
+        }
+    }
+
+    uint64_t begin(colorIdType n) const { return offsets[n]; }
+    uint64_t end(colorIdType n) const { return offsets[n + 1]; }
+
+    void clear() {
+        std::vector<uint64_t>().swap(offsets);
+        std::vector<colorIdType>().swap(neighbors);
+        std::vector<uint32_t>().swap(weights);
+    }
+};
+
+// phases of the MST construction that are checkpointed on disk, in order
+enum class MSTPhase : uint32_t {
+    none = 0,
+    edgeSets = 1,
+    weights = 2,
+    parents = 3
+};
+
+// header of each phase's checkpoint file
+struct MSTCheckpointHeader {
+    uint64_t magic{mantis::MST_CKPT_MAGIC};
+    uint32_t version{mantis::MST_CKPT_VERSION};
+    uint32_t phase{0};
+    uint64_t numSamples{0};
+    uint64_t numBuffers{0};
+    uint64_t bufferSize{0};
+    uint64_t numColorClasses{0};
+    uint64_t k{0};
+};
+
 class MST {
 public:
-    MST(std::string prefix, std::shared_ptr<spdlog::logger> logger, uint32_t numThreads);
+    MST(std::string prefix, std::shared_ptr<spdlog::logger> logger, uint32_t numThreads,
+        bool resume = false);
 
     void buildMST();
 
+    void setGapEncodeDeltas() { gapEncodeDeltas = true; }
+
+    void buildMSTFromEdges(const std::vector<std::string> &edgeFiles,
+                           uint64_t numColorClasses, uint64_t kmerSize);
+
 private:
+    void buildMSTFromEdgeSets(MSTPhase completed);
+
     bool buildEdgeSets();
 
+    void bucketEdges(const std::vector<std::string> &edgeFiles);
+
+    template <uint32_t K>
     void findNeighborEdges(CQF<KeyObject> &cqf, KeyObject &keyobj, std::vector<Edge> &edgeList);
 
     bool calculateWeights();
 
-    bool encodeColorClassUsingMST();
+    void buildParentBV();
 
-    DisjointSets kruskalMSF();
+    bool encodeColorClassUsingMST(bool parentsLoaded);
+
+    bool storeGapEncodedDeltas(sdsl::int_vector<> &deltabv);
+
+    std::string checkpointFile(MSTPhase phase);
+
+    MSTPhase lastCompletedPhase();
 
-    std::set<workItem> neighbors(CQF<KeyObject> &cqf, workItem n);
+    uint64_t countIndexColorClasses();
 
-    bool exists(CQF<KeyObject> &cqf, dna::canonical_kmer e, uint64_t &eqid);
+    void storeCheckpoint(MSTPhase phase);
+
+    bool loadCheckpoint(MSTPhase phase);
+
+    void removeCheckpoint(MSTPhase phase);
+
+    DisjointSets kruskalMSF();
+
+    bool exists(CQF<KeyObject> &cqf, uint64_t kmer, uint64_t &eqid);
 
     uint64_t hammingDist(uint64_t eqid1, uint64_t eqid2,
                          uint64_t &srcId, std::vector<uint64_t> &srcEq);
@@ -162,16 +238,32 @@ private:
                                            std::vector<spp::sparse_hash_set<Edge, edge_hash>> &edgesetList,
                                            sdsl::bit_vector &nodes, uint64_t &maxId, uint64_t &numOfKmers);
 
-    void calcHammingDistInParallel(uint32_t i, std::vector<Edge> &edgeList);
+    void writeEdges(std::ofstream &file, const spp::sparse_hash_set<Edge, edge_hash> &edgeSet,
+                    std::vector<Edge> &edgeList);
+
+    std::pair<uint64_t, uint64_t> getThreadEdgeRange(uint32_t i, uint64_t listSize);
+
+    void calcHammingDistInParallel(uint32_t i, std::vector<Edge> &edgeList,
+                                   std::vector<uint32_t> &edgeWeights,
+                                   std::vector<uint64_t> &weightCnts);
+
+    void scatterEdgesInParallel(uint32_t i, std::vector<Edge> &edgeList,
+                                std::vector<uint32_t> &edgeWeights,
+                                std::vector<uint64_t> &weightOffsets);
 
-    void calcDeltasInParallel(uint32_t threadID, uint64_t cbvID1, uint64_t cbvID2,
-            sdsl::int_vector<> &parentbv, sdsl::int_vector<> &deltabv,
-            sdsl::bit_vector::select_1_type &sbbv );
+    void calcDeltasInParallel(uint32_t threadID,
+                              std::vector<colorIdType>::const_iterator nodesBegin,
+                              std::vector<colorIdType>::const_iterator nodesEnd,
+                              sdsl::int_vector<> &deltabv,
+                              sdsl::bit_vector::select_1_type &sbbv,
+                              std::vector<std::pair<uint64_t, uint32_t>> &spill);
 
     std::string prefix;
     uint32_t numSamples = 0;
-    uint64_t k;
+    uint64_t k{0};
     uint64_t num_of_ccBuffers;
+    // color classes per eq class file (set by mantis build)
+    uint64_t bvBufferSize{mantis::NUM_BV_BUFFER};
     uint64_t num_edges = 0;
     uint64_t num_colorClasses = 0;
     uint64_t mstTotalWeight = 0;
@@ -182,7 +274,11 @@ private:
     std::vector<std::string> eqclass_files;
     std::vector<std::vector<Edge>> edgeBucketList;
     std::vector<std::vector<Edge>> weightBuckets;
-    std::vector<std::vector<std::pair<colorIdType, uint32_t> >> mst;
+    MSTAdjacency mst;
+    sdsl::int_vector<> parentbv;
+    sdsl::bit_vector bbv;
+    bool resume{false};
+    bool gapEncodeDeltas{false};
     spdlog::logger *logger{nullptr};
     uint32_t nThreads = 1;
     SpinLockT colorMutex;
@@ -10,6 +10,9 @@
 #include "mantisconfig.hpp"
 #include "lru/lru.hpp"
 #include "gqf_cpp.h"
+#include "staticKmerMap.h"
+#include "kmerExtractor.h"
+#include "queryFilter.h"
 #include "common_types.h"
 #include "tsl/hopscotch_map.h"
 #include "nonstd/optional.hpp"
@@ -64,36 +67,67 @@ private:
     spdlog::logger *logger{nullptr};
     mantis::QueryMap kmer2cidMap;
     mantis::EqMap cid2expMap;
+    KmerExtractor indexKmers;
+    KmerExtractor queryKmers;
+    // returned by getResultList and convertIndexK2QueryK, reused by the next read
+    mantis::QueryResult result;
+    // scratch space of findFilteredSamples
+    std::vector<std::pair<uint64_t, uint64_t>> queryColors;
+    std::vector<uint64_t> candidates;
+
+    // sets the color class of the k-mers of kmer2cidMap that are in dbg
+    template <class DbgT>
+    void lookupKmers(DbgT &dbg);
+    // the samples of the color class, decoded once per read
+    const std::vector<uint64_t> &decodeColor(uint64_t eqclass_id, LRUCacheMap &lru_cache,
+                                             RankScores *rs, QueryStats &queryStats);
 
 public:
     uint32_t queryK;
     uint32_t indexK;
     sdsl::int_vector<> parentbv;
     sdsl::int_vector<> deltabv;
+    // gap-encoded deltas (if the index was built with mantis mst -g), bbv then marks bytes
+    sdsl::int_vector<8> deltavb;
+    bool gapEncodedDeltas{false};
     sdsl::bit_vector::select_1_type sbbv;
 
     MSTQuery(std::string prefix, uint32_t indexKIn, uint32_t queryKIn,
             uint64_t numSamplesIn, spdlog::logger *loggerIn) :
-    numSamples(numSamplesIn), indexK(indexKIn), queryK(queryKIn), logger(loggerIn) {
+    numSamples(numSamplesIn), indexK(indexKIn), queryK(queryKIn), logger(loggerIn),
+    indexKmers(indexKIn), queryKmers(queryKIn), result(numSamplesIn) {
         numWrds = (uint64_t) std::ceil((double) numSamples / 64.0);
         loadIdx(prefix);
     }
 
     void loadIdx(std::string indexDir);
+
+    void useHugePages();
     std::vector<uint64_t> buildColor(uint64_t eqid, QueryStats &queryStats,
                                      LRUCacheMap *lru_cache,
                                      RankScores* rs,
                                      nonstd::optional<uint64_t>& toDecode // output param.  Also decode these
                                      );
 
-    void parseKmers(std::string read, uint64_t kmer_size);
-    void findSamples(CQF<KeyObject> &dbg,
+    void parseKmers(const std::string &read);
+    // DbgT is CQF<KeyObject> or StaticKmerMap
+    template <class DbgT>
+    void findSamples(DbgT &dbg,
                                         LRUCacheMap &lru_cache,
                                         RankScores *rs,
                                         QueryStats &queryStats);
-    mantis::QueryResult convertIndexK2QueryK(std::string &read);
-
-    mantis::QueryResult getResultList();
+    // the samples of the read that filter reports (queryK == indexK)
+    template <class DbgT>
+    mantis::QueryResult &findFilteredSamples(DbgT &dbg,
+                                             LRUCacheMap &lru_cache,
+                                             RankScores *rs,
+                                             QueryStats &queryStats,
+                                             const QueryFilter &filter);
+    // only the samples that filter reports
+    mantis::QueryResult &convertIndexK2QueryK(std::string &read,
+                                              const QueryFilter &filter = QueryFilter());
+
+    mantis::QueryResult &getResultList();
 
     void reset();
 
@@ -0,0 +1,108 @@
+#ifndef MANTIS_QUERYFILTER_H
+#define MANTIS_QUERYFILTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "common_types.h"
+
+// k-mers of a query of numKmers k-mers a sample needs with mantis query --theta
+inline uint64_t thetaThreshold(double theta, uint64_t numKmers) {
+    // 0.7 * 10 is a little above 7
+    return std::max<uint64_t>(1, std::ceil(theta * numKmers - 1e-9));
+}
+
+/**
+ * The samples of a query that mantis query reports with --theta and --top:
+ * those with at least a fraction theta of its k-mers, and of them the top with
+ * the most k-mers. All the samples hit are reported when neither is set.
+ */
+struct QueryFilter {
+    double theta{0};
+    uint64_t top{0};
+
+    bool enabled() const { return theta > 0 or top > 0; }
+
+    uint64_t minCount(uint64_t numKmers) const {
+        return theta > 0 ? thetaThreshold(theta, numKmers) : 0;
+    }
+
+    // zeroes the counts of the samples that are not reported
+    void apply(mantis::QueryResult &result, uint64_t numKmers) const {
+        if (theta > 0) {
+            result.keep_at_least(minCount(numKmers));
+        }
+        if (top > 0) {
+            result.keep_top(top);
+        }
+    }
+};
+
+/**
+ * Counts the k-mers of a query in the samples that filter reports.
+ * colors holds (k-mers, color class) for the color classes of the numKmers k-mers of
+ * the query. The classes are visited by decreasing number of k-mers, and a sample
+ * needs at least the theta threshold, and at least the top-th largest count so far
+ * with --top. As long as the k-mers of the classes left could bring a sample not seen
+ * yet to that bound, the classes are decoded with forEachSample(class, fn). After
+ * that, only the samples that can still reach it (their count plus the k-mers left)
+ * are counted, each tested with hasSample(class, sample), and the classes left are
+ * skipped once none can. result ends up with the reported samples, with their exact
+ * counts. candidates is scratch space.
+ */
+template <class ForEachSample, class HasSample>
+void countFilteredSamples(std::vector<std::pair<uint64_t, uint64_t>> &colors, uint64_t numKmers,
+                          const QueryFilter &filter, mantis::QueryResult &result,
+                          std::vector<uint64_t> &candidates, ForEachSample forEachSample,
+                          HasSample hasSample) {
+    uint64_t minCount = filter.minCount(numKmers);
+    // the top-th largest count only grows, and so does the bound. It's the top
+    // of the heap the result keeps as the counts grow
+    auto bound = [&]() {
+        return filter.top > 0 ? std::max(minCount, result.kth_largest(filter.top)) : minCount;
+    };
+    std::sort(colors.begin(), colors.end(), std::greater<std::pair<uint64_t, uint64_t>>());
+    uint64_t left = 0;
+    for (auto &color : colors) {
+        left += color.first;
+    }
+    result.clear();
+    result.track_largest(filter.top);
+    uint64_t i = 0;
+    for (; i < colors.size() and left >= bound(); ++i) {
+        uint64_t count = colors[i].first;
+        forEachSample(colors[i].second, [&](uint64_t sample) { result.add(sample, count); });
+        left -= count;
+    }
+    uint64_t minFinal = bound();
+    candidates.clear();
+    result.for_each_hit([&](uint64_t sample, uint64_t count) {
+        if (count + left >= minFinal) {
+            candidates.push_back(sample);
+        }
+    });
+    for (; i < colors.size() and !candidates.empty(); ++i) {
+        uint64_t count = colors[i].first;
+        left -= count;
+        for (auto sample : candidates) {
+            if (hasSample(colors[i].second, sample)) {
+                result.add(sample, count);
+            }
+        }
+        minFinal = bound();
+        uint64_t kept = 0;
+        for (auto sample : candidates) {
+            if (result[sample] + left >= minFinal) {
+                candidates[kept++] = sample;
+            }
+        }
+        candidates.resize(kept);
+    }
+    filter.apply(result, numKmers);
+}
+
+#endif //MANTIS_QUERYFILTER_H
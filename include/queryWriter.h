@@ -0,0 +1,125 @@
+#ifndef MANTIS_QUERYWRITER_H
+#define MANTIS_QUERYWRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+
+#include "common_types.h"
+#include "mantisconfig.hpp"
+#include "ProgOpts.h"
+
+// the hits of consecutive queries
+struct QueryBatch {
+    uint64_t firstQuery{0};
+    // per query: its k-mers and the end of its hits
+    std::vector<std::pair<uint64_t, uint64_t>> queries;
+    // (sample, count)
+    std::vector<std::pair<uint64_t, uint64_t>> hits;
+
+    void clear() {
+        queries.clear();
+        hits.clear();
+    }
+};
+
+/**
+ * Buffered output to a file, gzip compressed or not.
+ */
+class QueryOutput {
+public:
+    QueryOutput(FILE *file, gzFile gz) : file(file), gz(gz) {
+        out.reserve(mantis::QUERY_WRITER_BUFFER);
+    }
+
+    void put(const char *s, uint64_t len) { out.append(s, len); }
+    void put(const char *s) { put(s, std::strlen(s)); }
+    void put(const std::string &s) { out.append(s); }
+    void put(char c) { out.push_back(c); }
+    void putNumber(uint64_t v);
+    template <class T>
+    void putBinary(const T &v) { put(reinterpret_cast<const char *>(&v), sizeof(v)); }
+
+    uint64_t size() const { return out.size(); }
+
+    // writes (and compresses) the buffered output
+    void flush();
+
+    // flushes and moves back to the start of the file
+    // @return false if the file can't be written there (a pipe, or compressed)
+    bool rewind();
+
+    void close();
+
+private:
+    std::string out;
+    FILE *file;
+    gzFile gz;
+};
+
+/**
+ * How the results are written, called on the background thread of the QueryWriter.
+ */
+class QueryFormat {
+public:
+    virtual ~QueryFormat() = default;
+
+    virtual void begin(QueryOutput &out) {}
+    virtual void format(const QueryBatch &batch, QueryOutput &out) = 0;
+    virtual void end(QueryOutput &out) {}
+};
+
+/**
+ * Writes the results of the queries in the order they are given.
+ * The hits of the queries are copied into batches, which a background thread
+ * formats, compresses with --gzip, and writes while the next queries run. The
+ * batches and the output buffer are reused, so nothing is allocated per query
+ * once they have grown.
+ */
+class QueryWriter {
+public:
+    QueryWriter(std::unique_ptr<QueryFormat> format, FILE *file, gzFile gz);
+
+    // closes the writer if close wasn't called
+    ~QueryWriter();
+
+    // the result of the next query, which has numKmers k-mers
+    void write(uint64_t numKmers, mantis::QueryResult &result);
+
+    // writes the remaining queries and the end of the output, then closes the file
+    void close();
+
+private:
+    void submit();
+    void run();
+
+    std::unique_ptr<QueryFormat> queryFormat;
+    QueryOutput out;
+    QueryBatch filling;
+    QueryBatch full;
+    QueryBatch formatting;
+    bool fullReady{false};
+    bool closing{false};
+    bool closed{false};
+    uint64_t numQueries{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread formatter;
+};
+
+// creates the writer of the results to opt.output in the format asked for, the
+// queries being named queryLabel followed by their number in the TSV output
+std::unique_ptr<QueryWriter> makeQueryWriter(const QueryOpts &opt,
+                                             const std::vector<std::string> &sampleNames,
+                                             const std::string &queryLabel);
+
+#endif //MANTIS_QUERYWRITER_H
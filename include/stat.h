@@ -82,8 +82,10 @@ private:
     LRUCacheMap* cache_lru;
     nonstd::optional<uint64_t> toDecode{nonstd::nullopt};
     QueryStats queryStats;
-    std::set<workItem> neighbors(workItem n);
-    bool exists(dna::canonical_kmer e, uint64_t &eqid, uint64_t &eqidx);
+    // walks the monochromatic component of the current kmer
+    template <uint32_t K>
+    Mc_stats monochromeComponent();
+    bool exists(uint64_t kmer, uint64_t &eqid, uint64_t &eqidx);
     uint64_t globalFuckingCounter = 0;
 };
 
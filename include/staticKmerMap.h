@@ -0,0 +1,88 @@
+#ifndef MANTIS_STATICKMERMAP_H
+#define MANTIS_STATICKMERMAP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "sdsl/bit_vectors.hpp"
+#include "gqf_cpp.h"
+#include "mantisconfig.hpp"
+
+/**
+ * Immutable replacement for the dbg CQF of a built index (mantis build --static-map)
+ * A minimal perfect hash (BBHash-style cascade of bit arrays) maps each k-mer to
+ * a slot holding the CQF hash of the k-mer and its color class id.
+ * K-mers that are not in the index land in the slot of another k-mer or in none,
+ * and are rejected by comparing their hash, so the answers are those of the CQF.
+ */
+class StaticKmerMap {
+public:
+    StaticKmerMap() = default;
+    // the rank support points into levels, so the map can't be copied or moved
+    StaticKmerMap(const StaticKmerMap &) = delete;
+    StaticKmerMap &operator=(const StaticKmerMap &) = delete;
+
+    // builds the map over all the k-mers of the dbg CQF
+    void build(const CQF<KeyObject> &cqf, spdlog::logger *logger);
+
+    void serialize(const std::string &filename) const;
+
+    bool load(const std::string &filename);
+
+    // backs the loaded map with transparent huge pages
+    void useHugePages(spdlog::logger *logger);
+
+    // same contract as CQF<KeyObject>::query:
+    // the count stored for the k-mer (color class id + 1) or 0 if it is absent
+    uint64_t query(const KeyObject &k, uint8_t flags) const;
+
+    uint32_t keybits() const { return keyBits; }
+
+    uint64_t dist_elts() const { return numKmers; }
+
+private:
+    struct Header {
+        uint64_t magic{mantis::STATIC_MAP_MAGIC};
+        uint32_t version{mantis::STATIC_MAP_VERSION};
+        uint32_t keyBits{0};
+        uint32_t hashMode{0};
+        uint32_t seed{0};
+        uint64_t numKmers{0};
+        uint64_t numLevels{0};
+        uint64_t numFallback{0};
+        __uint128_t range{0};
+    };
+
+    // size of each level relative to the number of k-mers left to place
+    static constexpr double gamma = 2.0;
+    static constexpr uint32_t maxLevels = 25;
+
+    uint64_t hashKey(uint64_t key) const;
+
+    uint64_t levelPos(uint64_t hash, uint32_t level) const;
+
+    uint64_t lookup(uint64_t hash) const;
+
+    void addLevel(sdsl::bit_vector &seen, const sdsl::bit_vector &collided,
+                  std::vector<sdsl::bit_vector> &levelBits);
+
+    uint32_t keyBits{0};
+    uint32_t hashMode{0};
+    uint32_t seed{0};
+    __uint128_t range{0};
+    uint64_t numKmers{0};
+    uint64_t numPlaced{0};
+    std::vector<uint64_t> levelOffsets;
+    sdsl::bit_vector levels;
+    sdsl::rank_support_v5<1> levelsRank;
+    // hashes of the k-mers left after the last level, sorted
+    // the i-th one is mapped to numPlaced + i
+    std::vector<uint64_t> fallback;
+    // the hash of the k-mer of each slot, keyBits wide
+    sdsl::int_vector<> hashes;
+    sdsl::int_vector<> colorIds;
+};
+
+#endif //MANTIS_STATICKMERMAP_H
@@ -18,6 +18,8 @@
 
 #include <inttypes.h>
 
+#include "gqf/gqf.h"
+
 #ifdef DEBUG
 #define PRINT_DEBUG 1
 #else
@@ -73,4 +75,32 @@ std::string first_part(std::string str, char c);
 /* Print elapsed time using the start and end timeval */
 void print_time_elapsed(std::string desc, struct timeval* start, struct
 												timeval* end);
+
+/* Asks the kernel to back the huge-page aligned part of [addr, addr + len)
+ * with transparent huge pages. Meant for memory that is already populated
+ * (e.g. sdsl vectors after loading), so the pages are also collapsed right
+ * away where the kernel supports MADV_COLLAPSE. */
+void advise_huge_pages(const void* addr, uint64_t len);
+
+/* Returns the number of bytes of [addr, addr + len) that are backed by
+ * transparent huge pages, according to /proc/self/smaps. */
+uint64_t anon_huge_page_bytes(const void* addr, uint64_t len);
+
+/* Describes the pages backing the CQF (see qf_set_hugepages), for the log. */
+std::string cqf_page_info(const QF* qf);
+
+/* Returns the ids of the online NUMA nodes. */
+std::vector<uint32_t> numa_nodes(void);
+
+/* Interleaves the pages the calling thread allocates from now on across all
+ * the NUMA nodes (MPOL_INTERLEAVE), or goes back to allocating them on the
+ * local node. Returns false if the kernel has no NUMA support. */
+bool set_numa_interleave(bool enabled);
+
+/* Returns the bytes of the process resident on each NUMA node (indexed by
+ * node id), from /proc/self/numa_maps. */
+std::vector<uint64_t> numa_bytes_per_node(void);
+
+/* numa_bytes_per_node for the log, e.g. "node 0: 812.5 MiB, node 1: 810.2 MiB" */
+std::string numa_placement_info(void);
 #endif
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "colorMatrix.h"
+
+namespace {
+inline uint64_t pad8(uint64_t bytes) {
+    return (bytes + 7) / 8 * 8;
+}
+}
+
+/**
+ * @param bits rows of numSamples bits, the way ColoredDbg buffers the color classes
+ * @param numRows number of rows to encode from the start of bits
+ * @param numSamples width of a row
+ * @param filename color matrix file to write
+ */
+void ColorMatrix::write(const sdsl::bit_vector &bits, uint64_t numRows, uint64_t numSamples,
+                        const std::string &filename) {
+    Header header;
+    header.numSamples = numSamples;
+    header.numRows = numRows;
+    std::vector<uint64_t> rowOffsets(numRows + 1, 0);
+    std::vector<uint8_t> rowEncodings(paddedEncodings(numRows), 0);
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "Could not open color matrix " << filename << " for writing.\n";
+        std::exit(1);
+    }
+    // the offsets are rewritten once the rows are
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(rowOffsets.data()), rowOffsets.size() * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char *>(rowEncodings.data()), rowEncodings.size());
+
+    uint64_t numWords = (numSamples + 63) / 64;
+    std::vector<uint64_t> words(numWords);
+    std::vector<uint32_t> ids, runs;
+    std::vector<char> row;
+    uint64_t offset = 0;
+    for (uint64_t r = 0; r < numRows; ++r) {
+        ids.clear();
+        runs.clear();
+        uint64_t start = r * numSamples;
+        uint64_t runStart = 0;
+        bool present = false;
+        for (uint64_t w = 0; w < numWords; ++w) {
+            uint64_t len = std::min<uint64_t>(64, numSamples - w * 64);
+            words[w] = bits.get_int(start + w * 64, len);
+            for (uint64_t i = 0; i < len; ++i) {
+                uint64_t sample = w * 64 + i;
+                bool bit = (words[w] >> i) & 1;
+                if (bit) {
+                    ids.push_back(sample);
+                }
+                if (bit != present) {
+                    runs.push_back(sample - runStart);
+                    runStart = sample;
+                    present = bit;
+                }
+            }
+        }
+        if (present) {
+            runs.push_back(numSamples - runStart);
+        }
+
+        uint64_t list16Bytes = numSamples <= (1ULL << 16) ? sizeof(uint32_t) + ids.size() * sizeof(uint16_t)
+                                                          : std::numeric_limits<uint64_t>::max();
+        uint64_t list32Bytes = sizeof(uint32_t) + ids.size() * sizeof(uint32_t);
+        uint64_t rawBytes = numWords * sizeof(uint64_t);
+        uint64_t runBytes = sizeof(uint32_t) + runs.size() * sizeof(uint32_t);
+        uint64_t bytes = std::min({list16Bytes, list32Bytes, rawBytes, runBytes});
+
+        row.assign(pad8(bytes), 0);
+        uint32_t n;
+        // lists win ties, they are the fastest to decode
+        if (bytes == list16Bytes || bytes == list32Bytes) {
+            n = ids.size();
+            std::copy_n(reinterpret_cast<const char *>(&n), sizeof(n), row.data());
+            if (bytes == list16Bytes) {
+                rowEncodings[r] = LIST16;
+                uint16_t *dst = reinterpret_cast<uint16_t *>(row.data() + sizeof(n));
+                std::copy(ids.begin(), ids.end(), dst);
+            } else {
+                rowEncodings[r] = LIST32;
+                std::copy_n(reinterpret_cast<const char *>(ids.data()), ids.size() * sizeof(uint32_t),
+                            row.data() + sizeof(n));
+            }
+        } else if (bytes == rawBytes) {
+            rowEncodings[r] = RAW;
+            std::copy_n(reinterpret_cast<const char *>(words.data()), rawBytes, row.data());
+        } else {
+            rowEncodings[r] = RUNS;
+            n = runs.size();
+            std::copy_n(reinterpret_cast<const char *>(&n), sizeof(n), row.data());
+            std::copy_n(reinterpret_cast<const char *>(runs.data()), runs.size() * sizeof(uint32_t),
+                        row.data() + sizeof(n));
+        }
+        rowOffsets[r] = offset;
+        out.write(row.data(), row.size());
+        offset += row.size();
+    }
+    rowOffsets[numRows] = offset;
+    header.dataBytes = offset;
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(rowOffsets.data()), rowOffsets.size() * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char *>(rowEncodings.data()), rowEncodings.size());
+    out.close();
+    if (!out) {
+        std::cerr << "Could not write color matrix " << filename << ".\n";
+        std::exit(1);
+    }
+}
+
+ColorMatrix::ColorMatrix(ColorMatrix &&other) noexcept :
+        mapping(other.mapping), mappedBytes(other.mappedBytes), header(other.header),
+        offsets(other.offsets), encodings(other.encodings), data(other.data) {
+    other.mapping = nullptr;
+    other.mappedBytes = 0;
+    other.header = nullptr;
+}
+
+ColorMatrix::~ColorMatrix() {
+    if (mapping) {
+        munmap(mapping, mappedBytes);
+    }
+}
+
+/**
+ * @param filename file written by write
+ * @return false if the file is not a color matrix of this version
+ */
+bool ColorMatrix::load(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || static_cast<uint64_t>(sb.st_size) < sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+    void *addr = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    const Header *h = reinterpret_cast<const Header *>(addr);
+    uint64_t expected = sizeof(Header) + (h->numRows + 1) * sizeof(uint64_t) +
+                        paddedEncodings(h->numRows) + h->dataBytes;
+    if (h->magic != mantis::COLOR_MATRIX_MAGIC || h->version != mantis::COLOR_MATRIX_VERSION ||
+        expected != static_cast<uint64_t>(sb.st_size)) {
+        munmap(addr, sb.st_size);
+        return false;
+    }
+    mapping = addr;
+    mappedBytes = sb.st_size;
+    header = h;
+    offsets = reinterpret_cast<const uint64_t *>(header + 1);
+    encodings = reinterpret_cast<const uint8_t *>(offsets + header->numRows + 1);
+    data = encodings + paddedEncodings(header->numRows);
+    return true;
+}
+
+bool ColorMatrix::contains(uint64_t row, uint64_t sample) const {
+    const uint8_t *p = data + offsets[row];
+    if (encodings[row] == RAW) {
+        const uint64_t *words = reinterpret_cast<const uint64_t *>(p);
+        return (words[sample / 64] >> (sample % 64)) & 1;
+    }
+    uint32_t n = *reinterpret_cast<const uint32_t *>(p);
+    p += sizeof(uint32_t);
+    if (encodings[row] == LIST16) {
+        const uint16_t *ids = reinterpret_cast<const uint16_t *>(p);
+        return std::binary_search(ids, ids + n, sample);
+    } else if (encodings[row] == LIST32) {
+        const uint32_t *ids = reinterpret_cast<const uint32_t *>(p);
+        return std::binary_search(ids, ids + n, sample);
+    }
+    const uint32_t *runs = reinterpret_cast<const uint32_t *>(p);
+    uint64_t start = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        start += runs[i];
+        if (sample < start) {
+            return i & 1;
+        }
+    }
+    return false;
+}
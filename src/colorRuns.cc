@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <functional>
+#include <iostream>
+
+#include "colorRuns.h"
+#include "gqf/gqf_int.h"
+#include "gqf/gqf_file.h"
+#include "gqf/hashutil.h"
+
+namespace {
+// iterator over the k-mer hashes of one input CQF of a group
+struct SampleIterator {
+    QFi qfi;
+    uint64_t hash{0};
+    uint32_t id;
+
+    SampleIterator(const QF *qf, uint32_t id) : id(id) {
+        if (qf_iterator_from_position(qf, &qfi, 0) != QFI_INVALID) {
+            getHash();
+            qfi_initial_madvise(&qfi);
+        }
+    }
+
+    bool next() {
+        if (qfi_next_madvise(&qfi) == QFI_INVALID) {
+            return false;
+        }
+        getHash();
+        return true;
+    }
+
+    bool end() const { return qfi_end(&qfi); }
+
+    bool operator>(const SampleIterator &rhs) const { return hash > rhs.hash; }
+
+private:
+    void getHash() {
+        uint64_t value, count;
+        qfi_get_hash(&qfi, &hash, &value, &count);
+    }
+};
+
+void wordsToBits(const uint64_t *words, uint64_t numBits, sdsl::bit_vector &colors, uint64_t offset) {
+    for (uint64_t i = 0; i * 64 < numBits; ++i) {
+        uint64_t len = std::min<uint64_t>(64, numBits - i * 64);
+        colors.set_int(offset + i * 64, words[i], len);
+    }
+}
+}
+
+ColorRunWriter::ColorRunWriter(const std::string &filename, uint64_t numSamples) :
+        filename(filename), out(filename, std::ios::binary), words((numSamples + 63) / 64) {
+    header.numSamples = numSamples;
+    if (!out.is_open()) {
+        std::cerr << "Could not open color run " << filename << " for writing.\n";
+        std::exit(1);
+    }
+    // rewritten by close
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+void ColorRunWriter::putVarint(uint64_t v) {
+    while (v >= 0x80) {
+        out.put(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+        ++offset;
+    }
+    out.put(static_cast<char>(v));
+    ++offset;
+}
+
+void ColorRunWriter::add(uint64_t hash, const sdsl::bit_vector &colors) {
+    __uint128_t classHash = MurmurHash128A((void *) colors.data(), words * 8,
+                                           2038074743, 2038074751);
+    auto it = classIds.find(classHash);
+    uint64_t id;
+    if (it == classIds.end()) {
+        id = header.numClasses++;
+        classIds.insert(std::make_pair(classHash, id));
+        table.insert(table.end(), colors.data(), colors.data() + words);
+    } else {
+        id = it->second;
+    }
+    // the first hash is stored as is
+    putVarint(hash - lastHash);
+    putVarint(id);
+    lastHash = hash;
+    ++header.numKmers;
+}
+
+void ColorRunWriter::close() {
+    header.tableOffset = offset;
+    out.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(uint64_t));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.close();
+    if (!out) {
+        std::cerr << "Could not write color run " << filename << ".\n";
+        std::exit(1);
+    }
+    classIds.clear();
+    std::vector<uint64_t>().swap(table);
+}
+
+ColorRunReader::ColorRunReader(const std::string &filename) : in(filename, std::ios::binary) {
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        header.magic != mantis::COLOR_RUN_MAGIC || header.version != mantis::COLOR_RUN_VERSION) {
+        std::cerr << "Color run " << filename << " is missing or corrupted.\n";
+        std::exit(1);
+    }
+    words = (header.numSamples + 63) / 64;
+    table.resize(header.numClasses * words);
+    in.seekg(header.tableOffset);
+    in.read(reinterpret_cast<char *>(table.data()), table.size() * sizeof(uint64_t));
+    in.seekg(sizeof(header));
+    if (!in) {
+        std::cerr << "Color run " << filename << " is truncated.\n";
+        std::exit(1);
+    }
+}
+
+uint64_t ColorRunReader::getVarint() {
+    uint64_t v = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+        uint64_t byte = static_cast<uint8_t>(in.get());
+        v |= (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return v;
+        }
+    }
+}
+
+bool ColorRunReader::next() {
+    if (kmersRead == header.numKmers) {
+        return false;
+    }
+    curHash += getVarint();
+    curClass = getVarint();
+    ++kmersRead;
+    return true;
+}
+
+void ColorRunReader::addColors(sdsl::bit_vector &colors, uint64_t offset) const {
+    wordsToBits(table.data() + curClass * words, header.numSamples, colors, offset);
+}
+
+ColorRunMerger::ColorRunMerger(const std::vector<std::string> &filenames) {
+    for (auto &filename : filenames) {
+        runs.emplace_back(new ColorRunReader(filename));
+        offsets.push_back(numSamples);
+        numSamples += runs.back()->samples();
+        if (runs.back()->next()) {
+            heap.emplace_back(runs.back()->hash(), runs.size() - 1);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), std::greater<std::pair<uint64_t, uint32_t>>());
+}
+
+bool ColorRunMerger::next(uint64_t &hash, sdsl::bit_vector &colors) {
+    if (heap.empty()) {
+        return false;
+    }
+    std::fill(colors.data(), colors.data() + (colors.capacity() >> 6), 0);
+    hash = heap.front().first;
+    auto greater = std::greater<std::pair<uint64_t, uint32_t>>();
+    // the samples of a run are not in any other run, so only the bits of the
+    // runs holding the k-mer are set
+    while (!heap.empty() && heap.front().first == hash) {
+        uint32_t run = heap.front().second;
+        runs[run]->addColors(colors, offsets[run]);
+        std::pop_heap(heap.begin(), heap.end(), greater);
+        if (runs[run]->next()) {
+            heap.back().first = runs[run]->hash();
+            std::push_heap(heap.begin(), heap.end(), greater);
+        } else {
+            heap.pop_back();
+        }
+    }
+    return true;
+}
+
+/**
+ * @param cqfs the input CQFs of the group, the samples of the run in order
+ * @param filename color run to write
+ */
+void writeColorRun(const std::vector<const CQF<KeyObject> *> &cqfs, const std::string &filename) {
+    std::vector<SampleIterator> heap;
+    for (uint32_t i = 0; i < cqfs.size(); ++i) {
+        SampleIterator it(cqfs[i]->get_cqf(), i);
+        if (!it.end()) {
+            heap.push_back(it);
+        }
+    }
+    auto greater = std::greater<SampleIterator>();
+    std::make_heap(heap.begin(), heap.end(), greater);
+
+    ColorRunWriter writer(filename, cqfs.size());
+    sdsl::bit_vector colors(cqfs.size());
+    while (!heap.empty()) {
+        std::fill(colors.data(), colors.data() + (colors.capacity() >> 6), 0);
+        uint64_t hash = heap.front().hash;
+        do {
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            SampleIterator &cur = heap.back();
+            colors[cur.id] = 1;
+            if (cur.next()) {
+                std::push_heap(heap.begin(), heap.end(), greater);
+            } else {
+                heap.pop_back();
+            }
+        } while (!heap.empty() && heap.front().hash == hash);
+        writer.add(hash, colors);
+    }
+    writer.close();
+}
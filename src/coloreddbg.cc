@@ -18,6 +18,7 @@
 #include <set>
 #include <unordered_set>
 #include <bitset>
+#include <cmath>
 #include <cassert>
 #include <fstream>
 
@@ -39,6 +40,9 @@
 #include "MantisFS.h"
 #include "ProgOpts.h"
 #include "coloreddbg.h"
+#include "colorRuns.h"
+#include "hyperLogLog.h"
+#include "mst.h"
 #include "squeakrconfig.h"
 #include "json.hpp"
 #include "mantis_utils.hpp"
@@ -104,10 +108,14 @@ build_main ( BuildOpts& opt )
 
 	std::vector<SampleObject<CQF<KeyObject>*>> inobjects;
   std::vector<CQF<KeyObject>> cqfs;
+	// hierarchical build: the inputs are merged in groups into color runs, so
+	// that at most group_size of them are open at any time
+	bool hierarchical = opt.group_size > 0 && num_samples > opt.group_size;
+	std::vector<std::string> squeakr_files;
 
 	// reserve QF structs for input CQFs
   inobjects.reserve(num_samples);
-  cqfs.reserve(num_samples);
+  cqfs.reserve(hierarchical ? opt.group_size : num_samples);
 
 	// mmap all the input cqfs
 	std::string squeakr_file;
@@ -130,7 +138,7 @@ build_main ( BuildOpts& opt )
 			console->error("Can't read Squeakr file. It was written on a different endian machine.");
 			exit(1);
 		}
-		if (cqfs.size() == 0)
+		if (nqf == 0)
 			kmer_size = config.kmer_size;
 		else {
 			if (kmer_size != config.kmer_size) {
@@ -142,39 +150,170 @@ build_main ( BuildOpts& opt )
 		if (config.cutoff == 1) {
 			console->warn("Squeakr file {} is not filtered.", squeakr_file);
 		}
+		if (kmer_size > mantis::MAX_K) {
+			console->error("Squeakr file {} has {}-mers, k can be at most {}.",
+										 squeakr_file, kmer_size, mantis::MAX_K);
+			exit(1);
+		}
 
-    cqfs.emplace_back(squeakr_file, CQF_MMAP);
 		//std::string sample_id = first_part(first_part(last_part(squeakr_file, '/'),
 																									//'.'), '_');
 		std::string sample_id = squeakr_file;
+		squeakr_files.push_back(squeakr_file);
+		if (hierarchical) {
+			// opened group by group below
+			inobjects.emplace_back(nullptr, sample_id, nqf);
+			nqf++;
+			continue;
+		}
+    cqfs.emplace_back(squeakr_file, CQF_MMAP);
 		console->info("Reading CQF {} Seed {}",nqf, cqfs[nqf].seed());
 		console->info("Sample id {}", sample_id);
 		cqfs.back().dump_metadata();
     inobjects.emplace_back(&cqfs[nqf], sample_id, nqf);
 		if (!cqfs.front().check_similarity(&cqfs.back())) {
-			console->error("Passed Squeakr files are not similar.", squeakr_file);
+			console->error("Squeakr file {} is not similar to the first one.", squeakr_file);
 			exit(1);
 		}
     nqf++;
 	}
 
+	uint32_t keybits, seed;
+	enum qf_hashmode hash_mode;
+	__uint128_t range;
+	std::vector<std::string> run_files;
+	if (hierarchical) {
+		{
+			CQF<KeyObject> first(squeakr_files[0], CQF_MMAP);
+			keybits = first.keybits();
+			hash_mode = first.hash_mode();
+			seed = first.seed();
+			range = first.range();
+			first.close();
+		}
+		console->info("Merging the inputs in groups of {} into color runs.",
+									opt.group_size);
+		uint32_t group = 0;
+		for (uint32_t start = 0; start < nqf; start += opt.group_size, group++) {
+			uint32_t end = std::min<uint32_t>(start + opt.group_size, nqf);
+			std::vector<const CQF<KeyObject>*> group_cqfs;
+			for (uint32_t i = start; i < end; i++) {
+				cqfs.emplace_back(squeakr_files[i], CQF_MMAP);
+				CQF<KeyObject>& cqf = cqfs.back();
+				if (cqf.hash_mode() != hash_mode || cqf.seed() != seed ||
+						cqf.keybits() != keybits || cqf.range() != range) {
+					console->error("Squeakr file {} is not similar to the first one.", squeakr_files[i]);
+					exit(1);
+				}
+				cqf.set_readahead((opt.readahead_mb << 20) / (end - start));
+				group_cqfs.push_back(&cqf);
+			}
+			run_files.push_back(prefix + mantis::COLOR_RUN_PREFIX + "0_" +
+													std::to_string(group) + ".run");
+			writeColorRun(group_cqfs, run_files.back());
+			for (auto& cqf : cqfs)
+				cqf.close();
+			cqfs.clear();
+		}
+		// merge the runs until they can all be open at the same time
+		for (uint32_t level = 1; run_files.size() > opt.group_size; level++) {
+			console->info("Merging {} color runs in groups of {}.", run_files.size(),
+										opt.group_size);
+			std::vector<std::string> merged_files;
+			for (uint64_t start = 0; start < run_files.size(); start += opt.group_size) {
+				uint64_t end = std::min<uint64_t>(start + opt.group_size,
+																					run_files.size());
+				std::vector<std::string> group_files(run_files.begin() + start,
+																						 run_files.begin() + end);
+				merged_files.push_back(prefix + mantis::COLOR_RUN_PREFIX +
+															 std::to_string(level) + "_" +
+															 std::to_string(merged_files.size()) + ".run");
+				ColorRunMerger runs(group_files);
+				ColorRunWriter writer(merged_files.back(), runs.samples());
+				BitVector colors(runs.samples());
+				uint64_t hash;
+				while (runs.next(hash, colors))
+					writer.add(hash, colors);
+				writer.close();
+				for (auto& file : group_files)
+					std::remove(file.c_str());
+			}
+			run_files.swap(merged_files);
+		}
+		if (opt.numthreads > 1) {
+			console->info("The merge of the color runs runs on a single thread.");
+		}
+	} else {
+		keybits = cqfs[0].keybits();
+		hash_mode = cqfs[0].hash_mode();
+		seed = cqfs[0].seed();
+	}
+
+	if (opt.qbits == 0) {
+		console->info("Estimating the number of distinct k-mers of the inputs.");
+		uint64_t num_kmers = estimateDistinctKmers(squeakr_files, opt.numthreads);
+		// the CQF resizes itself at 95% occupancy
+		double slots = num_kmers * mantis::OUTPUT_SLOTS_PER_KMER *
+			mantis::OUTPUT_SLOTS_HEADROOM / 0.95;
+		opt.qbits = std::max<int>(1, std::ceil(std::log2(std::max(slots, 1.0))));
+		opt.qbits = std::min<int>(opt.qbits, keybits - 1);
+		console->info("About {} distinct k-mers, the output CQF gets 2^{} slots.",
+									num_kmers, opt.qbits);
+	}
+	minfo["quotient_bits"] = opt.qbits;
+
 	ColoredDbg<SampleObject<CQF<KeyObject>*>, KeyObject> cdbg(opt.qbits,
-																														inobjects[0].obj->keybits(),
-																														cqfs[0].hash_mode(),
-																														inobjects[0].obj->seed(),
+																														keybits,
+																														hash_mode,
+																														seed,
 																														prefix, nqf, MANTIS_DBG_ON_DISK);
 	cdbg.set_console(console);
 	if (opt.flush_eqclass_dist) {
 		cdbg.set_flush_eqclass_dist();
   }
+	if (opt.build_mst) {
+		// neighbors are found by inverting the k-mer hashes
+		if (hash_mode != QF_HASH_INVERTIBLE) {
+			console->error("Building the MST during the build requires Squeakr files with invertible hashes.");
+			exit(1);
+		}
+		cdbg.set_collect_mst_edges();
+		if (opt.numthreads > 1) {
+			console->info("The merge runs on a single thread when the MST edges are collected.");
+		}
+	}
+	cdbg.set_num_threads(opt.numthreads);
+	cdbg.set_readahead_budget(opt.readahead_mb << 20);
+	if (opt.eqclass_buffer_mb > 0) {
+		uint64_t rows = std::max<uint64_t>((opt.eqclass_buffer_mb << 23) / nqf, 1);
+		console->info("Eq classes are buffered and written {} at a time.", rows);
+		cdbg.set_bv_buffer_rows(rows);
+	}
+	if (opt.color_matrix) {
+		if (opt.build_mst) {
+			console->error("The MST is built from the RRR color classes, so -m can't be used with --color-matrix.");
+			exit(1);
+		}
+		cdbg.set_color_matrix();
+	}
+	// the static map replaces the CQF anyway
+	if (opt.pack_color_ids && !opt.static_map) {
+		cdbg.set_pack_color_ids();
+	}
 
 	cdbg.build_sampleid_map(inobjects.data());
 
+	auto construct = [&](uint64_t num_kmers) -> default_cdbg_bv_map_t& {
+		if (hierarchical)
+			return cdbg.construct(run_files, num_kmers);
+		return cdbg.construct(inobjects.data(), num_kmers);
+	};
+
 	console->info("Sampling eq classes based on {} kmers", mantis::SAMPLE_SIZE);
 	// First construct the colored dbg on initial SAMPLE_SIZE k-mers.
 	default_cdbg_bv_map_t unsorted_map;
 
-	unsorted_map = cdbg.construct(inobjects.data(), mantis::SAMPLE_SIZE);
+	unsorted_map = construct(mantis::SAMPLE_SIZE);
 
 	console->info("Number of eq classes found after sampling {}",
 								unsorted_map.size());
@@ -204,7 +343,9 @@ build_main ( BuildOpts& opt )
 	console->info("Constructing the colored dBG.");
 
 	// Reconstruct the colored dbg using the new set of equivalence classes.
-	cdbg.construct(inobjects.data(), std::numeric_limits<uint64_t>::max());
+	construct(std::numeric_limits<uint64_t>::max());
+	for (auto& file : run_files)
+		std::remove(file.c_str());
 
 	console->info("Final colored dBG has {} k-mers and {} equivalence classes",
 								cdbg.get_cqf()->dist_elts(), cdbg.get_num_eqclasses());
@@ -216,6 +357,28 @@ build_main ( BuildOpts& opt )
 	cdbg.serialize();
 	console->info("Serialization done.");
 
+	if (opt.build_mst) {
+		console->info("Building the MST of the color graph collected during the merge.");
+		MST mst(prefix, opt.console, opt.numthreads);
+		mst.buildMSTFromEdges({cdbg.get_mst_edge_file()}, cdbg.get_num_eqclasses(),
+													kmer_size);
+		console->info("MST encoding done.");
+	}
+
+	if (opt.static_map) {
+		console->info("Replacing the CQF with a static k-mer map.");
+		std::string cqf_file(prefix + mantis::CQF_FILE);
+		{
+			CQF<KeyObject> cqf(cqf_file, CQF_FREAD);
+			StaticKmerMap kmer_map;
+			kmer_map.build(cqf, console);
+			kmer_map.serialize(prefix + mantis::STATIC_MAP_FILE);
+			cqf.free();
+		}
+		std::remove(cqf_file.c_str());
+		console->info("Static k-mer map written.");
+	}
+
   {
     std::ofstream jfile(prefix + "/" + mantis::meta_file_name);
     if (jfile.is_open()) {
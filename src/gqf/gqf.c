@@ -179,11 +179,13 @@ static bool qf_lock(QF *qf, uint64_t hash_bucket_index, bool small, uint8_t
 				CLUSTER_SIZE) {
 			if (!qf_spin_lock(qf,
 												&qf->runtimedata->locks[hash_bucket_index/NUM_SLOTS_TO_LOCK-1],
+												hash_bucket_index/NUM_SLOTS_TO_LOCK-1,
 												runtime_lock))
 				return false;
 		}
 		if (!qf_spin_lock(qf,
 											&qf->runtimedata->locks[hash_bucket_index/NUM_SLOTS_TO_LOCK],
+											hash_bucket_index/NUM_SLOTS_TO_LOCK,
 											runtime_lock)) {
 			if (hash_bucket_index >= NUM_SLOTS_TO_LOCK && hash_bucket_lock_offset <=
 					CLUSTER_SIZE)
@@ -191,6 +193,7 @@ static bool qf_lock(QF *qf, uint64_t hash_bucket_index, bool small, uint8_t
 			return false;
 		}
 		if (!qf_spin_lock(qf, &qf->runtimedata->locks[hash_bucket_index/NUM_SLOTS_TO_LOCK+1],
+											hash_bucket_index/NUM_SLOTS_TO_LOCK+1,
 											runtime_lock)) {
 			qf_spin_unlock(&qf->runtimedata->locks[hash_bucket_index/NUM_SLOTS_TO_LOCK]);
 			if (hash_bucket_index >= NUM_SLOTS_TO_LOCK && hash_bucket_lock_offset <=
@@ -1368,6 +1371,8 @@ static inline int insert1(QF *qf, __uint128_t hash, uint8_t runtime_lock)
 		if (operation >= 0) {
 			uint64_t empty_slot_index = find_first_empty_slot(qf, runend_index+1);
 			if (empty_slot_index >= qf->metadata->xnslots) {
+				if (GET_NO_LOCK(runtime_lock) != QF_NO_LOCK)
+					qf_unlock(qf, hash_bucket_index, /*small*/ true);
 				return QF_NO_SPACE;
 			}
 			shift_remainders(qf, insert_index, empty_slot_index);
@@ -1476,8 +1481,11 @@ static inline int insert(QF *qf, __uint128_t hash, uint64_t count, uint8_t
 																																							p, 
 																																							&new_values[67] - p, 
 																																							0);
-			if (!ret)
+			if (!ret) {
+				if (GET_NO_LOCK(runtime_lock) != QF_NO_LOCK)
+					qf_unlock(qf, hash_bucket_index, /*small*/ false);
 				return QF_NO_SPACE;
+			}
 			modify_metadata(&qf->runtimedata->pc_ndistinct_elts, 1);
 			ret_distance = runstart_index - hash_bucket_index;
 		} else { /* Non-empty bucket */
@@ -1504,8 +1512,11 @@ static inline int insert(QF *qf, __uint128_t hash, uint64_t count, uint8_t
 																																								p, 
 																																								&new_values[67] - p, 
 																																								0);
-				if (!ret)
+				if (!ret) {
+					if (GET_NO_LOCK(runtime_lock) != QF_NO_LOCK)
+						qf_unlock(qf, hash_bucket_index, /*small*/ false);
 					return QF_NO_SPACE;
+				}
 				modify_metadata(&qf->runtimedata->pc_ndistinct_elts, 1);
 				ret_distance = (current_end + 1) - hash_bucket_index;
 				/* Found a counter for this remainder.  Add in the new count. */
@@ -1518,8 +1529,11 @@ static inline int insert(QF *qf, __uint128_t hash, uint64_t count, uint8_t
 																																					p, 
 																																					&new_values[67] - p, 
 																																					current_end - runstart_index + 1);
-			if (!ret)
+			if (!ret) {
+				if (GET_NO_LOCK(runtime_lock) != QF_NO_LOCK)
+					qf_unlock(qf, hash_bucket_index, /*small*/ false);
 				return QF_NO_SPACE;
+			}
 			ret_distance = runstart_index - hash_bucket_index;
 				/* No counter for this remainder, but there are larger
 					 remainders, so we're not appending to the bucket. */
@@ -1532,8 +1546,11 @@ static inline int insert(QF *qf, __uint128_t hash, uint64_t count, uint8_t
 																																								p, 
 																																								&new_values[67] - p, 
 																																								0);
-				if (!ret)
+				if (!ret) {
+					if (GET_NO_LOCK(runtime_lock) != QF_NO_LOCK)
+						qf_unlock(qf, hash_bucket_index, /*small*/ false);
 					return QF_NO_SPACE;
+				}
 				modify_metadata(&qf->runtimedata->pc_ndistinct_elts, 1);
 			ret_distance = runstart_index - hash_bucket_index;
 			}
@@ -1553,6 +1570,7 @@ static inline int insert(QF *qf, __uint128_t hash, uint64_t count, uint8_t
 inline static int _remove(QF *qf, __uint128_t hash, uint64_t count, uint8_t
 													runtime_lock)
 {
+	qf->runtimedata->append_valid = false;
 	int ret_numfreedslots = 0;
 	uint64_t hash_remainder           = hash & BITMASK(qf->metadata->bits_per_slot);
 	uint64_t hash_bucket_index        = hash >> qf->metadata->bits_per_slot;
@@ -1746,24 +1764,109 @@ void *qf_destroy(QF *qf)
 	return (void*)qf->metadata;
 }
 
+static bool use_hugepages = false;
+
+void qf_set_hugepages(bool enabled)
+{
+	use_hugepages = enabled;
+}
+
+/* Size of the default hugetlb pages, 0 if the kernel has none. */
+static uint64_t hugetlb_page_size(void)
+{
+	uint64_t size = 0;
+	char line[256];
+	FILE *fin = fopen("/proc/meminfo", "r");
+	if (fin == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fin) != NULL) {
+		if (sscanf(line, "Hugepagesize: %" SCNu64 " kB", &size) == 1) {
+			size *= 1024;
+			break;
+		}
+	}
+	fclose(fin);
+	return size;
+}
+
+void *qf_alloc_buffer(QF *qf, uint64_t total_num_bytes)
+{
+	qf->runtimedata->mapped_bytes = 0;
+	qf->runtimedata->page_kind = QF_PAGES_DEFAULT;
+	qf->runtimedata->page_size = sysconf(_SC_PAGESIZE);
+	if (!use_hugepages)
+		return malloc(total_num_bytes);
+
+	uint64_t huge_page_size = hugetlb_page_size();
+	if (huge_page_size == 0)
+		huge_page_size = 2ULL << 20;
+	uint64_t len = (total_num_bytes + huge_page_size - 1) / huge_page_size *
+		huge_page_size;
+#ifdef MAP_HUGETLB
+	/* private hugetlb mappings reserve their pages up front, so this fails
+	 * rather than faulting later if too few huge pages are reserved */
+	void *buffer = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE |
+											MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (buffer != MAP_FAILED) {
+		qf->runtimedata->mapped_bytes = len;
+		qf->runtimedata->page_kind = QF_PAGES_HUGETLB;
+		qf->runtimedata->page_size = huge_page_size;
+		return buffer;
+	}
+#endif
+	/* Transparent huge pages only back huge-page aligned ranges, so map one
+	 * huge page more than needed and trim the mapping to an aligned start.
+	 * The advice is given before the pages are first touched (qf_init or the
+	 * read in qf_deserialize). */
+	char *mapping = (char *)mmap(NULL, len + huge_page_size, PROT_READ |
+															 PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+															 0);
+	if (mapping == MAP_FAILED)
+		return malloc(total_num_bytes);
+	char *start = (char *)(((uintptr_t)mapping + huge_page_size - 1) &
+												 ~(uintptr_t)(huge_page_size - 1));
+	if (start > mapping)
+		munmap(mapping, start - mapping);
+	munmap(start + len, mapping + huge_page_size - start);
+	qf->runtimedata->mapped_bytes = len;
+#ifdef MADV_HUGEPAGE
+	if (madvise(start, len, MADV_HUGEPAGE) == 0) {
+		qf->runtimedata->page_kind = QF_PAGES_TRANSPARENT;
+		qf->runtimedata->page_size = huge_page_size;
+	}
+#endif
+	return start;
+}
+
+enum qf_page_kind qf_get_page_kind(const QF *qf, uint64_t *page_size)
+{
+	if (qf->runtimedata->page_size == 0) {
+		/* file-backed or not allocated by qf_alloc_buffer */
+		*page_size = sysconf(_SC_PAGESIZE);
+		return QF_PAGES_DEFAULT;
+	}
+	*page_size = qf->runtimedata->page_size;
+	return qf->runtimedata->page_kind;
+}
+
 bool qf_malloc(QF *qf, uint64_t nslots, uint64_t key_bits, uint64_t
 							 value_bits, enum qf_hashmode hash, uint32_t seed)
 {
 	uint64_t total_num_bytes = qf_init(qf, nslots, key_bits, value_bits,
 																		 hash, seed, NULL, 0);
 
-	void *buffer = malloc(total_num_bytes);
-	if (buffer == NULL) {
-		perror("Couldn't allocate memory for the CQF.");
-		exit(EXIT_FAILURE);
-	}
-
 	qf->runtimedata = (qfruntime *)calloc(sizeof(qfruntime), 1);
 	if (qf->runtimedata == NULL) {
 		perror("Couldn't allocate memory for runtime data.");
 		exit(EXIT_FAILURE);
 	}
 
+	void *buffer = qf_alloc_buffer(qf, total_num_bytes);
+	if (buffer == NULL) {
+		perror("Couldn't allocate memory for the CQF.");
+		exit(EXIT_FAILURE);
+	}
+
 	uint64_t init_size = qf_init(qf, nslots, key_bits, value_bits, hash, seed,
 															 buffer, total_num_bytes);
 
@@ -1776,9 +1879,13 @@ bool qf_malloc(QF *qf, uint64_t nslots, uint64_t key_bits, uint64_t
 bool qf_free(QF *qf)
 {
 	assert(qf->metadata != NULL);
+	uint64_t mapped_bytes = qf->runtimedata->mapped_bytes;
 	void *buffer = qf_destroy(qf);
 	if (buffer != NULL) {
-		free(buffer);
+		if (mapped_bytes)
+			munmap(buffer, mapped_bytes);
+		else
+			free(buffer);
 		return true;
 	}
 
@@ -1798,12 +1905,13 @@ void qf_copy(QF *dest, const QF *src)
 
 void qf_reset(QF *qf)
 {
+	qf->runtimedata->append_valid = false;
 	qf->metadata->nelts = 0;
 	qf->metadata->ndistinct_elts = 0;
 	qf->metadata->noccupied_slots = 0;
 
 #ifdef LOG_WAIT_TIME
-	memset(qf->wait_times, 0,
+	memset(qf->runtimedata->wait_times, 0,
 				 (qf->runtimedata->num_locks+1)*sizeof(wait_time_data));
 #endif
 #if QF_BITS_PER_SLOT == 8 || QF_BITS_PER_SLOT == 16 || QF_BITS_PER_SLOT == 32 || QF_BITS_PER_SLOT == 64
@@ -1922,6 +2030,7 @@ int qf_insert(QF *qf, uint64_t key, uint64_t value, uint64_t count, uint8_t
 	}
 	uint64_t hash = (key << qf->metadata->value_bits) | (value &
 																											 BITMASK(qf->metadata->value_bits));
+	qf->runtimedata->append_valid = false;
 	int ret;
 	if (count == 1)
 		ret = insert1(qf, hash, flags);
@@ -1957,6 +2066,130 @@ int qf_insert(QF *qf, uint64_t key, uint64_t value, uint64_t count, uint8_t
 	return ret;
 }
 
+/* Finds the last bucket, its last remainder and the end of its run, i.e.,
+ * the point from which qf_append_sorted can write. */
+static void append_state_init(QF *qf)
+{
+	qfruntime *rt = qf->runtimedata;
+	rt->append_valid = true;
+	rt->append_empty = true;
+	rt->append_bucket = 0;
+	rt->append_remainder = 0;
+	rt->append_end = 0;
+	for (uint64_t i = qf->metadata->nblocks; i > 0; i--) {
+		uint64_t occupieds = get_block(qf, i - 1)->occupieds[0];
+		if (occupieds == 0)
+			continue;
+		uint64_t bucket = (i - 1) * QF_SLOTS_PER_BLOCK + bitscanreverse(occupieds);
+		uint64_t runstart = bucket == 0 ? 0 : run_end(qf, bucket - 1) + 1;
+		uint64_t remainder, count;
+		uint64_t current_end = decode_counter(qf, runstart, &remainder, &count);
+		while (!is_runend(qf, current_end))
+			current_end = decode_counter(qf, current_end + 1, &remainder, &count);
+		rt->append_empty = false;
+		rt->append_bucket = bucket;
+		rt->append_remainder = remainder;
+		rt->append_end = current_end + 1;
+		break;
+	}
+}
+
+int qf_append_sorted(QF *qf, uint64_t key, uint64_t value, uint64_t count,
+										 uint8_t flags)
+{
+	if (count == 0)
+		return 0;
+
+	if (GET_KEY_HASH(flags) != QF_KEY_IS_HASH) {
+		if (qf->metadata->hash_mode == QF_HASH_DEFAULT)
+			key = MurmurHash64A(((void *)&key), sizeof(key),
+													qf->metadata->seed) % qf->metadata->range;
+		else if (qf->metadata->hash_mode == QF_HASH_INVERTIBLE)
+			key = hash_64(key, BITMASK(qf->metadata->key_bits));
+	}
+	uint64_t hash = (key << qf->metadata->value_bits) | (value &
+																											 BITMASK(qf->metadata->value_bits));
+	uint64_t hash_remainder    = hash & BITMASK(qf->metadata->bits_per_slot);
+	uint64_t hash_bucket_index = hash >> qf->metadata->bits_per_slot;
+
+	qfruntime *rt = qf->runtimedata;
+	if (!rt->append_valid)
+		append_state_init(qf);
+	if (!rt->append_empty && (hash_bucket_index < rt->append_bucket ||
+														(hash_bucket_index == rt->append_bucket &&
+														 hash_remainder <= rt->append_remainder)))
+		return QF_NOT_SORTED;
+
+	uint64_t new_values[67];
+	uint64_t *p = encode_counter(qf, hash_remainder, count, &new_values[67]);
+	uint64_t total_remainders = &new_values[67] - p;
+	bool same_run = !rt->append_empty && hash_bucket_index == rt->append_bucket;
+	/* The run starts at its home bucket unless the previous run spills over it. */
+	uint64_t start_index = !rt->append_empty && rt->append_end > hash_bucket_index ?
+		rt->append_end : hash_bucket_index;
+
+	// Same fill checks as qf_insert, but resizing is done before writing since
+	// the resize reinserts everything anyway.
+	if (qf_get_num_occupied_slots(qf) >= qf->metadata->nslots * 0.95 ||
+			start_index + total_remainders > qf->metadata->xnslots ||
+			(rt->auto_resize && start_index - hash_bucket_index >
+			 DISTANCE_FROM_HOME_SLOT_CUTOFF)) {
+		if (!rt->auto_resize) {
+			fprintf(stderr, "The CQF is filling up.\n");
+			return QF_NO_SPACE;
+		}
+		fprintf(stdout, "Resizing the CQF.\n");
+		if (rt->container_resize(qf, qf->metadata->nslots * 2) < 0) {
+			fprintf(stderr, "Resize failed\n");
+			return QF_NO_SPACE;
+		}
+		fprintf(stderr, "Resize finished.\n");
+		/* The resized CQF has new runtime data, so the append state is rebuilt. */
+		return qf_append_sorted(qf, key, value, count, flags | QF_KEY_IS_HASH);
+	}
+
+	if (same_run)
+		METADATA_WORD(qf, runends, start_index - 1) &= ~(1ULL << (((start_index -
+																																1) %
+																															 QF_SLOTS_PER_BLOCK)
+																															% 64));
+	else
+		METADATA_WORD(qf, occupieds, hash_bucket_index) |= 1ULL <<
+			((hash_bucket_index % QF_SLOTS_PER_BLOCK) % 64);
+
+	for (uint64_t i = 0; i < total_remainders; i++)
+		set_slot(qf, start_index + i, p[i]);
+	uint64_t end_index = start_index + total_remainders - 1;
+	METADATA_WORD(qf, runends, end_index) |= 1ULL << ((end_index %
+																										 QF_SLOTS_PER_BLOCK) % 64);
+
+	/* Every block that starts after the home bucket and within the run now
+	 * begins with the tail of this run. */
+	for (uint64_t i = hash_bucket_index / QF_SLOTS_PER_BLOCK + 1;
+			 i * QF_SLOTS_PER_BLOCK <= end_index; i++) {
+		uint64_t offset = end_index - i * QF_SLOTS_PER_BLOCK + 1;
+		if (offset < BITMASK(8*sizeof(qf->blocks[0].offset)))
+			get_block(qf, i)->offset = offset;
+		else
+			get_block(qf, i)->offset = (uint8_t) BITMASK(8*sizeof(qf->blocks[0].offset));
+	}
+
+	rt->append_empty = false;
+	rt->append_bucket = hash_bucket_index;
+	rt->append_remainder = hash_remainder;
+	rt->append_end = end_index + 1;
+
+	modify_metadata(&qf->runtimedata->pc_ndistinct_elts, 1);
+	modify_metadata(&qf->runtimedata->pc_noccupied_slots, total_remainders);
+	modify_metadata(&qf->runtimedata->pc_nelts, count);
+
+	if (start_index - hash_bucket_index > DISTANCE_FROM_HOME_SLOT_CUTOFF) {
+		fprintf(stderr, "The CQF is filling up.\n");
+		return QF_NO_SPACE;
+	}
+	return start_index - hash_bucket_index;
+}
+
 int qf_set_count(QF *qf, uint64_t key, uint64_t value, uint64_t count, uint8_t
 								 flags)
 {
@@ -2155,6 +2388,25 @@ uint64_t qf_get_num_occupied_slots(const QF *qf) {
 	return qf->metadata->noccupied_slots;
 }
 
+bool qf_get_lock_stats(const QF *qf, uint64_t *locks_taken, uint64_t
+											 *single_attempt, uint64_t *time_single, uint64_t
+											 *time_spinning)
+{
+	*locks_taken = *single_attempt = *time_single = *time_spinning = 0;
+#ifdef LOG_WAIT_TIME
+	for (uint64_t i = 0; i <= qf->runtimedata->num_locks; i++) {
+		*locks_taken += qf->runtimedata->wait_times[i].locks_taken;
+		*single_attempt +=
+			qf->runtimedata->wait_times[i].locks_acquired_single_attempt;
+		*time_single += qf->runtimedata->wait_times[i].total_time_single;
+		*time_spinning += qf->runtimedata->wait_times[i].total_time_spinning;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
 uint64_t qf_get_num_key_bits(const QF *qf) {
 	return qf->metadata->key_bits;
 }
@@ -2208,6 +2460,7 @@ int64_t qf_iterator_from_position(const QF *qf, QFi *qfi, uint64_t position)
 
 	qfi->qf = qf;
 	qfi->num_clusters = 0;
+	qfi->readahead_end = 0;
 	qfi->run = position;
 	qfi->current = position == 0 ? 0 : run_end(qfi->qf, position-1) + 1;
 	if (qfi->current < position)
@@ -2240,6 +2493,7 @@ int64_t qf_iterator_from_key_value(const QF *qf, QFi *qfi, uint64_t key,
 
 	qfi->qf = qf;
 	qfi->num_clusters = 0;
+	qfi->readahead_end = 0;
 
 	if (GET_KEY_HASH(flags) != QF_KEY_IS_HASH) {
 		if (qf->metadata->hash_mode == QF_HASH_DEFAULT)
@@ -2283,12 +2537,19 @@ int64_t qf_iterator_from_key_value(const QF *qf, QFi *qfi, uint64_t key,
 	// starting at "position" is smaller than "hash" then find the start of the
 	// next run.
 	if (!is_occupied(qf, hash_bucket_index) || !flag) {
-		uint64_t position = hash_bucket_index;
-		assert(position < qf->metadata->nslots);
+		// the next run starts at the first occupied bucket after
+		// hash_bucket_index, not at the first one of its block
+		uint64_t position = hash_bucket_index + 1;
+		// no bucket after the last one, and its block may not exist
+		if (position >= qf->metadata->nslots) {
+			qfi->current = 0xffffffffffffffff;
+			return QFI_INVALID;
+		}
 		uint64_t block_index = position / QF_SLOTS_PER_BLOCK;
-		uint64_t idx = bitselect(get_block(qf, block_index)->occupieds[0], 0);
+		uint64_t idx = bitselect(get_block(qf, block_index)->occupieds[0] &
+														 ~BITMASK(position % QF_SLOTS_PER_BLOCK), 0);
 		if (idx == 64) {
-			while(idx == 64 && block_index < qf->metadata->nblocks) {
+			while(idx == 64 && block_index + 1 < qf->metadata->nblocks) {
 				block_index++;
 				idx = bitselect(get_block(qf, block_index)->occupieds[0], 0);
 			}
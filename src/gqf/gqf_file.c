@@ -291,17 +291,13 @@ uint64_t qf_deserialize(QF *qf, const char *filename)
 		perror("Couldn't allocate memory for runtime data.");
 		exit(EXIT_FAILURE);
 	}
-	qf->metadata = (qfmetadata *)calloc(sizeof(qfmetadata), 1);
-	if (qf->metadata == NULL) {
-		perror("Couldn't allocate memory for metadata.");
-		exit(EXIT_FAILURE);
-	}
-	int ret = fread(qf->metadata, sizeof(qfmetadata), 1, fin);
+	qfmetadata metadata;
+	int ret = fread(&metadata, sizeof(qfmetadata), 1, fin);
 	if (ret < 1) {
 		perror("Couldn't read metadata from file.");
 		exit(EXIT_FAILURE);
 	}
-	if (qf->metadata->magic_endian_number != MAGIC_NUMBER) {
+	if (metadata.magic_endian_number != MAGIC_NUMBER) {
 		fprintf(stderr, "Can't read the CQF. It was written on a different endian machine.");
 		exit(EXIT_FAILURE);
 	}
@@ -313,7 +309,7 @@ uint64_t qf_deserialize(QF *qf, const char *filename)
 	}
 	strcpy(qf->runtimedata->f_info.filepath, filename);
 	/* initlialize the locks in the QF */
-	qf->runtimedata->num_locks = (qf->metadata->xnslots/NUM_SLOTS_TO_LOCK)+2;
+	qf->runtimedata->num_locks = (metadata.xnslots/NUM_SLOTS_TO_LOCK)+2;
 	qf->runtimedata->metadata_lock = 0;
 	/* initialize all the locks to 0 */
 	qf->runtimedata->locks = (volatile int *)calloc(qf->runtimedata->num_locks,
@@ -322,13 +318,14 @@ uint64_t qf_deserialize(QF *qf, const char *filename)
 		perror("Couldn't allocate memory for runtime locks.");
 		exit(EXIT_FAILURE);
 	}
-	qf->metadata = (qfmetadata *)realloc(qf->metadata,
-																			 qf->metadata->total_size_in_bytes +
-																			 sizeof(qfmetadata));
+	qf->metadata = (qfmetadata *)qf_alloc_buffer(qf,
+																							 metadata.total_size_in_bytes +
+																							 sizeof(qfmetadata));
 	if (qf->metadata == NULL) {
 		perror("Couldn't allocate memory for metadata.");
 		exit(EXIT_FAILURE);
 	}
+	memcpy(qf->metadata, &metadata, sizeof(qfmetadata));
 	qf->blocks = (qfblock *)(qf->metadata + 1);
 	if (qf->blocks == NULL) {
 		perror("Couldn't allocate memory for blocks.");
@@ -370,6 +367,39 @@ static void make_madvise_calls(const QF *qf, uint64_t oldrun, uint64_t newrun)
   }
 }
 
+/* Reads the file ahead of the iterator. The window is only extended once
+   the iterator has consumed half of it, so this is one madvise call per
+   readahead_bytes / 2 bytes iterated. */
+static void make_readahead_calls(QFi *qfi)
+{
+  const QF *qf = qfi->qf;
+  uint64_t distance = qf->runtimedata->readahead_bytes;
+  if (distance == 0 || qfi->run >= qf->metadata->xnslots)
+    return;
+
+  uint64_t offset = (char *)get_block(qf, qfi->run / QF_SLOTS_PER_BLOCK) -
+    (char *)qf->blocks;
+  if (qfi->readahead_end > offset + distance / 2)
+    return;
+
+  uint64_t start = qfi->readahead_end > offset ? qfi->readahead_end : offset;
+  uint64_t end = offset + distance;
+  if (end > qf->metadata->total_size_in_bytes)
+    end = qf->metadata->total_size_in_bytes;
+  if (start < end) {
+    int page_size = sysconf(_SC_PAGESIZE);
+    char *addr = (char *)qf->blocks + start;
+    char *page = addr - ((intptr_t)addr % page_size);
+    madvise(page, (char *)qf->blocks + end - page, MADV_WILLNEED);
+  }
+  qfi->readahead_end = end;
+}
+
+void qf_set_readahead(QF *qf, uint64_t bytes)
+{
+  qf->runtimedata->readahead_bytes = bytes;
+}
+
 /* This wraps qfi_next, using madvise(DONTNEED) to reduce our RSS.
    Only valid on mmapped QFs, i.e. cqfs from qf_initfile and
    qf_usefile. */
@@ -380,6 +410,7 @@ int qfi_next_madvise(QFi *qfi)
   uint64_t newrun = qfi->run;
 
   make_madvise_calls(qfi->qf, oldrun, newrun);
+  make_readahead_calls(qfi);
   
   return result;
 }
@@ -390,5 +421,6 @@ int qfi_next_madvise(QFi *qfi)
 int qfi_initial_madvise(QFi *qfi)
 {
   make_madvise_calls(qfi->qf, 0, qfi->run);
+  make_readahead_calls(qfi);
   return 0;
 }
@@ -0,0 +1,67 @@
+#include <cmath>
+#include <thread>
+
+#include "hyperLogLog.h"
+#include "gqf_cpp.h"
+#include "gqf/gqf_int.h"
+#include "gqf/gqf_file.h"
+
+void HyperLogLog::merge(const HyperLogLog &other) {
+    for (uint64_t i = 0; i < registers.size(); ++i) {
+        if (other.registers[i] > registers[i]) {
+            registers[i] = other.registers[i];
+        }
+    }
+}
+
+uint64_t HyperLogLog::estimate() const {
+    double m = registers.size();
+    double sum = 0;
+    uint64_t zeros = 0;
+    for (auto r : registers) {
+        sum += std::ldexp(1.0, -r);
+        zeros += r == 0;
+    }
+    double alpha = 0.7213 / (1 + 1.079 / m);
+    double e = alpha * m * m / sum;
+    // linear counting is more accurate while many registers are still empty
+    if (e <= 2.5 * m && zeros) {
+        e = m * std::log(m / zeros);
+    }
+    return static_cast<uint64_t>(e);
+}
+
+/**
+ * @param cqfFiles input (Squeakr) CQFs
+ * @param numThreads the files are split round-robin over the threads
+ */
+uint64_t estimateDistinctKmers(const std::vector<std::string> &cqfFiles, uint32_t numThreads) {
+    numThreads = std::max<uint32_t>(1, std::min<uint64_t>(numThreads, cqfFiles.size()));
+    std::vector<HyperLogLog> sketches(numThreads);
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            for (uint64_t i = t; i < cqfFiles.size(); i += numThreads) {
+                std::string file = cqfFiles[i];
+                CQF<KeyObject> cqf(file, CQF_MMAP);
+                QFi qfi;
+                if (qf_iterator_from_position(cqf.get_cqf(), &qfi, 0) != QFI_INVALID && !qfi_end(&qfi)) {
+                    qfi_initial_madvise(&qfi);
+                    do {
+                        uint64_t hash, value, count;
+                        qfi_get_hash(&qfi, &hash, &value, &count);
+                        sketches[t].add(hash);
+                    } while (qfi_next_madvise(&qfi) != QFI_INVALID);
+                }
+                cqf.close();
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (uint32_t t = 1; t < numThreads; ++t) {
+        sketches[0].merge(sketches[t]);
+    }
+    return sketches[0].estimate();
+}
@@ -1,5 +1,6 @@
 #include <fstream>
 #include "kmer.h"
+#include "kmerExtractor.h"
 
 /*return the integer representation of the base */
 inline char Kmer::map_int(uint8_t base)
@@ -56,6 +57,13 @@ string int_to_str(uint64_t kmer, uint64_t kmer_size)
 /* Calculate the revsese complement of a kmer */
 __int128_t Kmer::reverse_complement(__int128_t kmer, uint64_t kmer_size)
 {
+	if (kmer_size <= 32) {
+		// reverse the bases of the word at once
+		uint64_t rc = __builtin_bswap64(static_cast<uint64_t>(kmer));
+		rc = ((rc >> 4) & 0x0f0f0f0f0f0f0f0f) | ((rc << 4) & 0xf0f0f0f0f0f0f0f0);
+		rc = ((rc >> 2) & 0x3333333333333333) | ((rc << 2) & 0xcccccccccccccccc);
+		return ~rc >> (64 - 2 * kmer_size);
+	}
 	__int128_t rc = 0;
 	uint8_t base = 0;
 	for (uint32_t i = 0; i < kmer_size; i++) {
@@ -87,79 +95,19 @@ mantis::QuerySets Kmer::parse_kmers(const char *filename, uint64_t kmer_size,
 	total_kmers = 0;
 	std::ifstream ipfile(filename);
 	std::string read;
+	KmerExtractor extractor(kmer_size);
 	while (ipfile >> read) {
-		mantis::QuerySet kmers_set;
-
-start_read:
 		if (read.length() < kmer_size)
 			continue;
-		{
-			uint64_t first = 0;
-			uint64_t first_rev = 0;
-			uint64_t item = 0;
-			for(uint32_t i = 0; i < kmer_size; i++) { //First kmer
-				uint8_t curr = Kmer::map_base(read[i]);
-				if (curr > DNA_MAP::G) { // 'N' is encountered
-					if (i + 1 < read.length())
-						read = read.substr(i + 1, read.length());
-					else
-						goto next_read;
-					goto start_read;
-				}
-				first = first | curr;
-				first = first << 2;
-			}
-			first = first >> 2;
-			first_rev = Kmer::reverse_complement(first, kmer_size);
-
-			//cout << "kmer: "; cout << int_to_str(first);
-			//cout << " reverse-comp: "; cout << int_to_str(first_rev) << endl;
-
-			if (Kmer::compare_kmers(first, first_rev))
-				item = first;
-			else
-				item = first_rev;
-
-			kmers_set.insert(item);
-			if (is_bulk)
-				if (uniqueKmers.find(item) == uniqueKmers.end())
-					uniqueKmers[item] = 0;
-
-			uint64_t next = (first << 2) & BITMASK(2*kmer_size);
-			uint64_t next_rev = first_rev >> 2;
-
-			for(uint32_t i=kmer_size; i<read.length(); i++) { //next kmers
-				//cout << "K: " << read.substr(i-K+1,K) << endl;
-				uint8_t curr = Kmer::map_base(read[i]);
-				if (curr > DNA_MAP::G) { // 'N' is encountered
-					if (i + 1 < read.length())
-						read = read.substr(i + 1, read.length());
-					else
-						goto next_read;
-					goto start_read;
-				}
-				next |= curr;
-				uint64_t tmp = Kmer::reverse_complement_base(curr);
-				tmp <<= (kmer_size*2-2);
-				next_rev = next_rev | tmp;
-				if (Kmer::compare_kmers(next, next_rev))
-					item = next;
-				else
-					item = next_rev;
-
-				kmers_set.insert(item);
-				if (is_bulk)
-					if (uniqueKmers.find(item) == uniqueKmers.end())
-						uniqueKmers[item] = 0;
-
-				next = (next << 2) & BITMASK(2*kmer_size);
-				next_rev = next_rev >> 2;
-			}
-		}
-next_read:
+		mantis::QuerySet kmers_set;
+		extractor.forEachKmer(read.data(), read.length(),
+				[&](uint64_t, uint64_t item) {
+					kmers_set.insert(item);
+					if (is_bulk)
+						if (uniqueKmers.find(item) == uniqueKmers.end())
+							uniqueKmers[item] = 0;
+				});
 		total_kmers += kmers_set.size();
-		//if (kmers_set.size() != kmers.size())
-		//std::cout << "set size: " << kmers_set.size() << " vector size: " << kmers.size() << endl;
 		multi_kmers.push_back(kmers_set);
 	}
 	return multi_kmers;
@@ -0,0 +1,58 @@
+#include <array>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "kmerExtractor.h"
+
+namespace {
+struct BaseTable {
+    std::array<uint8_t, 256> codes;
+
+    BaseTable() {
+        codes.fill(KmerExtractor::AMBIGUOUS);
+        codes['A'] = DNA_MAP::A;
+        codes['C'] = DNA_MAP::C;
+        codes['G'] = DNA_MAP::G;
+        codes['T'] = DNA_MAP::T;
+    }
+};
+
+const BaseTable baseTable;
+}
+
+constexpr uint8_t KmerExtractor::AMBIGUOUS;
+
+KmerExtractor::KmerExtractor(uint64_t k) : kmerSize(k), mask(BITMASK(2 * k)), revShift(2 * k - 2) {}
+
+void KmerExtractor::encode(const char *seq, uint64_t len, uint8_t *codes) {
+    uint64_t i = 0;
+#ifdef __SSE2__
+    // bits 1-2 of the ASCII code tell A (00), C (01), T (10) and G (11) apart;
+    // DNA_MAP swaps A and C, whose bit 2 is 0
+    const __m128i three = _mm_set1_epi8(3);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i ambiguous = _mm_set1_epi8(AMBIGUOUS);
+    const __m128i a = _mm_set1_epi8('A'), c = _mm_set1_epi8('C');
+    const __m128i g = _mm_set1_epi8('G'), t = _mm_set1_epi8('T');
+    for (; i + 16 <= len; i += 16) {
+        __m128i bases = _mm_loadu_si128(reinterpret_cast<const __m128i *>(seq + i));
+        __m128i code = _mm_and_si128(_mm_srli_epi16(bases, 1), three);
+        code = _mm_xor_si128(code, _mm_andnot_si128(_mm_srli_epi16(bases, 2), one));
+        __m128i valid = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bases, a), _mm_cmpeq_epi8(bases, c)),
+                                     _mm_or_si128(_mm_cmpeq_epi8(bases, g), _mm_cmpeq_epi8(bases, t)));
+        code = _mm_or_si128(_mm_and_si128(valid, code), _mm_andnot_si128(valid, ambiguous));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(codes + i), code);
+    }
+#endif
+    for (; i < len; ++i) {
+        codes[i] = baseTable.codes[static_cast<uint8_t>(seq[i])];
+    }
+}
+
+uint64_t KmerExtractor::extract(const char *seq, uint64_t len, std::vector<uint64_t> &kmers) {
+    uint64_t before = kmers.size();
+    forEachKmer(seq, len, [&kmers](uint64_t, uint64_t kmer) { kmers.push_back(kmer); });
+    return kmers.size() - before;
+}
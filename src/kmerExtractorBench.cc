@@ -0,0 +1,87 @@
+/*
+ * Throughput of KmerExtractor against the base-at-a-time loop it replaced.
+ * usage: kmerExtractorBench [k] [read length] [number of reads] [ambiguous bases per 1000]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "kmer.h"
+#include "kmerExtractor.h"
+
+namespace {
+// canonical k-mers of read, with Kmer::map_base and the rolling update of the query paths
+void referenceKmers(const std::string &read, uint64_t k, std::vector<uint64_t> &kmers) {
+    uint64_t fwd = 0, rev = 0, valid = 0;
+    for (char base : read) {
+        uint64_t curr = Kmer::map_base(base);
+        if (curr > DNA_MAP::G) {
+            valid = 0;
+            continue;
+        }
+        fwd = ((fwd << 2) | curr) & BITMASK(2 * k);
+        rev = (rev >> 2) | (static_cast<uint64_t>(Kmer::reverse_complement_base(curr)) << (2 * k - 2));
+        if (++valid >= k) {
+            kmers.push_back(Kmer::compare_kmers(fwd, rev) ? fwd : rev);
+        }
+    }
+}
+
+template <class F>
+double seconds(F fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t k = argc > 1 ? std::stoull(argv[1]) : 23;
+    uint64_t readLength = argc > 2 ? std::stoull(argv[2]) : 150;
+    uint64_t numReads = argc > 3 ? std::stoull(argv[3]) : 1000000;
+    uint64_t ambiguousPerMille = argc > 4 ? std::stoull(argv[4]) : 1;
+    if (k == 0 || k > 32) {
+        std::cerr << "k must be in [1, 32]\n";
+        return 1;
+    }
+
+    srand(1);
+    std::vector<std::string> reads(numReads);
+    for (auto &read : reads) {
+        read = Kmer::generate_random_string(readLength);
+        for (auto &base : read) {
+            if (static_cast<uint64_t>(rand() % 1000) < ambiguousPerMille) {
+                base = 'N';
+            }
+        }
+    }
+
+    // both outputs are allocated and touched before timing
+    std::vector<uint64_t> expected(numReads * readLength), kmers(numReads * readLength);
+    expected.clear();
+    kmers.clear();
+    double referenceTime = seconds([&]() {
+        for (auto &read : reads) {
+            referenceKmers(read, k, expected);
+        }
+    });
+    KmerExtractor extractor(k);
+    double extractorTime = seconds([&]() {
+        for (auto &read : reads) {
+            extractor.extract(read.data(), read.length(), kmers);
+        }
+    });
+    if (kmers != expected) {
+        std::cerr << "KmerExtractor and the reference disagree\n";
+        return 1;
+    }
+
+    double megabases = numReads * readLength / 1e6;
+    std::cout << "k-mers: " << kmers.size() << "\n";
+    std::cout << "reference: " << megabases / referenceTime << " Mbases/s\n";
+    std::cout << "KmerExtractor: " << megabases / extractorTime << " Mbases/s\n";
+    return 0;
+}
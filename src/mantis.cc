@@ -96,8 +96,16 @@ int main ( int argc, char *argv[] ) {
   auto build_mode = (
                      command("build").set(selected, mode::build),
                      option("-e", "--eqclass_dist").set(bopt.flush_eqclass_dist) % "write the eqclass abundance distribution",
-										 required("-s","--log-slots") & value("log-slots",
-																											 bopt.qbits) % "log of number of slots in the output CQF",
+                     option("-m", "--mst").set(bopt.build_mst) % "build the MST encoding of the color classes during the build (same as running mantis mst -k afterwards)",
+                     option("-t", "--threads") & value("num_threads", bopt.numthreads) % "number of threads used to merge the input filters and to build the MST",
+                     option("--static-map").set(bopt.static_map) % "replace the output CQF with a static (minimal perfect hash) k-mer map",
+                     option("--pack-color-ids").set(bopt.pack_color_ids) % "store the color class ids in fixed-width value bits of the output CQF instead of its counters",
+                     option("--color-matrix").set(bopt.color_matrix) % "write the color classes as a color matrix (per-row sample lists, bit vectors or runs) instead of RRR bit vectors",
+                     option("--readahead-mb") & value("readahead_mb", bopt.readahead_mb) % "page cache budget (MB) for reading the input filters ahead of the merge, 0 to turn it off (default: 1024)",
+                     option("--eqclass-buffer-mb") & value("eqclass_buffer_mb", bopt.eqclass_buffer_mb) % "memory (MB) for the color classes buffered before they are compressed and written, which sets how many go in each file (default: 0, 20M color classes)",
+                     option("--group-size") & value("group_size", bopt.group_size) % "merge the input filters in groups of this size through intermediate files, so that at most this many are open at once (default: 0, all open)",
+										 option("-s","--log-slots") & value("log-slots",
+																											 bopt.qbits) % "log of number of slots in the output CQF (default: sized from a HyperLogLog estimate of the input k-mers)",
                      required("-i", "--input-list") & value(ensure_file_exists, "input_list", bopt.inlist) % "file containing list of input filters",
                      required("-o", "--output") & value("build_output", bopt.out) % "directory where results should be written"
                      );
@@ -105,6 +113,8 @@ int main ( int argc, char *argv[] ) {
           command("mst").set(selected, mode::build_mst),
                   required("-p", "--index-prefix") & value(ensure_dir_exists, "index_prefix", qopt.prefix) % "The directory where the index is stored.",
                   option("-t", "--threads") & value("num_threads", qopt.numThreads) % "number of threads",
+                  option("-r", "--resume").set(qopt.resume_mst) % "Checkpoint each phase, and resume from the last phase completed by an interrupted run.",
+                  option("-g", "--gap-encode").set(qopt.gap_encode_deltas) % "Store the delta lists gap-encoded with a variable-byte code instead of fixed-width entries if that is smaller.",
                   (
                           required("-k", "--keep-RRR").set(qopt.keep_colorclasses) % "Keep the previous color class RRR representation."
                           |
@@ -124,7 +134,13 @@ int main ( int argc, char *argv[] ) {
                      option("-1", "--use-colorclasses").set(qopt.use_colorclasses)
                      % "Use color classes as the color info representation instead of MST",
                      option("-j", "--json").set(qopt.use_json) % "Write the output in JSON format",
+                     option("--binary").set(qopt.use_binary) % "Write the output as a binary sparse matrix of the sample counts",
+                     option("--gzip").set(qopt.gzip) % "Compress the output with gzip",
                      option("-k", "--kmer") & value("kmer", qopt.k) % "size of k for kmer.",
+                     option("--theta") & value("theta", qopt.theta) % "Report only the samples with at least this fraction of the k-mers of a query",
+                     option("--top") & value("top", qopt.top) % "Report only this many samples with the most k-mers of a query",
+                     option("--huge-pages").set(qopt.huge_pages) % "Back the CQF and the color index with huge pages",
+                     option("--numa-interleave").set(qopt.numa_interleave) % "Interleave the pages of the index across the NUMA nodes",
                      required("-p", "--input-prefix") & value(ensure_dir_exists, "query_prefix", qopt.prefix) % "Prefix of input files.",
                      option("-o", "--output") & value("output_file", qopt.output) % "Where to write query output.",
                      value(ensure_file_exists, "query", qopt.query_file) % "Prefix of input files."
@@ -3,6 +3,7 @@
 //
 // Created by Fatemeh Almodaresi.
 //
+#include <chrono>
 #include <string>
 #include <sstream>
 #include <cstdio>
@@ -10,12 +11,13 @@
 
 #include "MantisFS.h"
 #include "mst.h"
+#include "dbgColorIds.h"
 #include "ProgOpts.h"
 
 #define MAX_ALLOWED_TMP_EDGES 31250000
 
-MST::MST(std::string prefixIn, std::shared_ptr<spdlog::logger> loggerIn, uint32_t numThreads) :
-        prefix(std::move(prefixIn)), lru_cache(10000), nThreads(numThreads) {
+MST::MST(std::string prefixIn, std::shared_ptr<spdlog::logger> loggerIn, uint32_t numThreads, bool resumeIn) :
+        prefix(std::move(prefixIn)), lru_cache(10000), nThreads(numThreads), resume(resumeIn) {
     logger = loggerIn.get();
 
     // Make sure the prefix is a full folder
@@ -30,6 +32,12 @@ MST::MST(std::string prefixIn, std::shared_ptr<spdlog::logger> loggerIn, uint32_
 
     eqclass_files =
             mantis::fs::GetFilesExt(prefix.c_str(), mantis::EQCLASS_FILE);
+    if (eqclass_files.empty() &&
+        !mantis::fs::GetFilesExt(prefix.c_str(), mantis::COLOR_MATRIX_FILE).empty()) {
+        logger->error("The MST is built from the RRR color classes, and index {} was built with --color-matrix",
+                      prefix);
+        std::exit(1);
+    }
 
     // sort eqclass_files
     // note to @robP: It terribly statically relies on the format of the input files!!
@@ -54,6 +62,13 @@ MST::MST(std::string prefixIn, std::shared_ptr<spdlog::logger> loggerIn, uint32_
     }
     sampleid.close();
     logger->info("# of experiments: {}", numSamples);
+
+    // every eq class file but the last one holds a full buffer of color classes
+    if (!eqclass_files.empty() && numSamples) {
+        BitVectorRRR bv;
+        sdsl::load_from_file(bv, eqclass_files[0]);
+        bvBufferSize = std::max<uint64_t>(bv.size() / numSamples, 1);
+    }
 }
 
 /**
@@ -63,14 +78,206 @@ MST::MST(std::string prefixIn, std::shared_ptr<spdlog::logger> loggerIn, uint32_
  * 2. calculate the weights of edges in the color graph
  *      This phase requires at most two buffers of color classes
  * 3. find MST of the weighted color graph
+ * In resume mode, the output of each phase is checkpointed in the index directory,
+ * and the phases already completed by a previous run are skipped
  */
 void MST::buildMST() {
-    buildEdgeSets();
-    calculateWeights();
-    encodeColorClassUsingMST();
+    MSTPhase completed = resume ? lastCompletedPhase() : MSTPhase::none;
+    if (completed != MSTPhase::none) {
+        logger->info("Resuming MST construction after phase {} using {}",
+                     static_cast<uint32_t>(completed), checkpointFile(completed));
+        if (!loadCheckpoint(completed)) {
+            logger->error("Could not load checkpoint file {}", checkpointFile(completed));
+            std::exit(1);
+        }
+    }
+    if (completed < MSTPhase::edgeSets) {
+        buildEdgeSets();
+        storeCheckpoint(MSTPhase::edgeSets);
+    }
+    buildMSTFromEdgeSets(completed);
+}
+
+/**
+ * Builds the MST from the color graph edges collected while building the colored dbg,
+ * so the dbg CQF doesn't need to be loaded and iterated over again.
+ * @param edgeFiles files of edges in the same format as the temporary files of buildEdgeSets
+ * (they're removed after being read)
+ * @param numColorClasses total number of color classes in the colored dbg
+ * @param kmerSize k of the colored dbg
+ */
+void MST::buildMSTFromEdges(const std::vector<std::string> &edgeFiles,
+                            uint64_t numColorClasses, uint64_t kmerSize) {
+    k = kmerSize;
+    num_colorClasses = numColorClasses;
+    edgeBucketList.resize(num_of_ccBuffers * num_of_ccBuffers);
+    bucketEdges(edgeFiles);
+    storeCheckpoint(MSTPhase::edgeSets);
+    buildMSTFromEdgeSets(MSTPhase::edgeSets);
+}
+
+/**
+ * runs the phases after building the edge sets of the color graph
+ * 2. calculate the weights of edges in the color graph
+ * 3. find MST of the weighted color graph and encode the color classes
+ * @param completed last phase that is already done
+ */
+void MST::buildMSTFromEdgeSets(MSTPhase completed) {
+    if (completed < MSTPhase::weights) {
+        calculateWeights();
+        storeCheckpoint(MSTPhase::weights);
+        removeCheckpoint(MSTPhase::edgeSets);
+    }
+    encodeColorClassUsingMST(completed == MSTPhase::parents);
+    removeCheckpoint(MSTPhase::edgeSets);
+    removeCheckpoint(MSTPhase::weights);
+    removeCheckpoint(MSTPhase::parents);
     logger->info("# of times the node was found in the cache: {}", gcntr);
 }
 
+std::string MST::checkpointFile(MSTPhase phase) {
+    switch (phase) {
+        case MSTPhase::edgeSets: return prefix + mantis::MST_EDGES_CKPT_FILE;
+        case MSTPhase::weights: return prefix + mantis::MST_WEIGHTS_CKPT_FILE;
+        case MSTPhase::parents: return prefix + mantis::MST_PARENTS_CKPT_FILE;
+        default: return std::string();
+    }
+}
+
+/**
+ * counts the color classes of the index from the sizes of its eq class files
+ * every file but the last one holds bvBufferSize color classes
+ */
+uint64_t MST::countIndexColorClasses() {
+    if (eqclass_files.empty() || !numSamples) {
+        return 0;
+    }
+    BitVectorRRR bv;
+    sdsl::load_from_file(bv, eqclass_files.back());
+    return (num_of_ccBuffers - 1) * bvBufferSize + bv.size() / numSamples;
+}
+
+/**
+ * finds the latest phase with a valid checkpoint in the index directory
+ * a checkpoint is valid if its header matches the version and the index it's built for
+ * @return the last completed phase or MSTPhase::none if there is no valid checkpoint
+ */
+MSTPhase MST::lastCompletedPhase() {
+    // the checkpoints count the dummy node zero as a color class
+    uint64_t numColorClasses = countIndexColorClasses() + 1;
+    for (auto phase : {MSTPhase::parents, MSTPhase::weights, MSTPhase::edgeSets}) {
+        std::ifstream in(checkpointFile(phase), std::ios::in | std::ios::binary);
+        if (!in.is_open()) continue;
+        MSTCheckpointHeader header;
+        in.read(reinterpret_cast<char *>(&header), sizeof(header));
+        if (!in or header.magic != mantis::MST_CKPT_MAGIC) {
+            logger->warn("Ignoring corrupted checkpoint {}", checkpointFile(phase));
+            continue;
+        }
+        if (header.version != mantis::MST_CKPT_VERSION) {
+            logger->warn("Ignoring checkpoint {} with version {}. Expected: {}",
+                         checkpointFile(phase), header.version, mantis::MST_CKPT_VERSION);
+            continue;
+        }
+        if (header.phase != static_cast<uint32_t>(phase) or
+            header.numSamples != numSamples or header.numBuffers != num_of_ccBuffers or
+            header.bufferSize != bvBufferSize or header.numColorClasses != numColorClasses) {
+            logger->warn("Ignoring checkpoint {} which belongs to a different index", checkpointFile(phase));
+            continue;
+        }
+        return phase;
+    }
+    return MSTPhase::none;
+}
+
+/**
+ * writes the output of the phase to its checkpoint file, in resume mode only
+ * The file is written under a temporary name and renamed at the end,
+ * so an existing checkpoint file is always complete
+ */
+void MST::storeCheckpoint(MSTPhase phase) {
+    if (!resume) {
+        return;
+    }
+    std::string filename = checkpointFile(phase);
+    std::string tmpFilename = filename + ".tmp";
+    logger->info("Checkpointing phase {} in {}", static_cast<uint32_t>(phase), filename);
+    std::ofstream out(tmpFilename, std::ios::out | std::ios::binary);
+    MSTCheckpointHeader header;
+    header.phase = static_cast<uint32_t>(phase);
+    header.numSamples = numSamples;
+    header.numBuffers = num_of_ccBuffers;
+    header.bufferSize = bvBufferSize;
+    header.numColorClasses = num_colorClasses;
+    header.k = k;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    auto writeEdgeLists = [&out](std::vector<std::vector<Edge>> &lists) {
+        uint64_t cnt = lists.size();
+        out.write(reinterpret_cast<const char *>(&cnt), sizeof(cnt));
+        for (auto &l : lists) {
+            cnt = l.size();
+            out.write(reinterpret_cast<const char *>(&cnt), sizeof(cnt));
+            out.write(reinterpret_cast<const char *>(l.data()), sizeof(Edge) * cnt);
+        }
+    };
+    if (phase == MSTPhase::edgeSets) {
+        writeEdgeLists(edgeBucketList);
+    } else if (phase == MSTPhase::weights) {
+        writeEdgeLists(weightBuckets);
+    } else if (phase == MSTPhase::parents) {
+        out.write(reinterpret_cast<const char *>(&mstTotalWeight), sizeof(mstTotalWeight));
+        parentbv.serialize(out);
+        bbv.serialize(out);
+    }
+    out.close();
+    if (!out or std::rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        // not fatal, the build just can't be resumed from this phase
+        logger->warn("Could not write checkpoint file {}", filename);
+        std::remove(tmpFilename.c_str());
+    }
+}
+
+/**
+ * loads the output of the phase from its checkpoint file
+ * @return true if the checkpoint was loaded successfully
+ */
+bool MST::loadCheckpoint(MSTPhase phase) {
+    std::ifstream in(checkpointFile(phase), std::ios::in | std::ios::binary);
+    MSTCheckpointHeader header;
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!in) return false;
+    num_colorClasses = header.numColorClasses;
+    k = header.k;
+    zero = static_cast<colorIdType>(num_colorClasses - 1);
+    auto readEdgeLists = [&in](std::vector<std::vector<Edge>> &lists) {
+        uint64_t cnt{0};
+        in.read(reinterpret_cast<char *>(&cnt), sizeof(cnt));
+        lists.resize(cnt);
+        for (auto &l : lists) {
+            in.read(reinterpret_cast<char *>(&cnt), sizeof(cnt));
+            l.resize(cnt);
+            in.read(reinterpret_cast<char *>(l.data()), sizeof(Edge) * cnt);
+        }
+    };
+    if (phase == MSTPhase::edgeSets) {
+        readEdgeLists(edgeBucketList);
+    } else if (phase == MSTPhase::weights) {
+        readEdgeLists(weightBuckets);
+    } else if (phase == MSTPhase::parents) {
+        in.read(reinterpret_cast<char *>(&mstTotalWeight), sizeof(mstTotalWeight));
+        parentbv.load(in);
+        bbv.load(in);
+    }
+    return static_cast<bool>(in);
+}
+
+void MST::removeCheckpoint(MSTPhase phase) {
+    std::string filename = checkpointFile(phase);
+    if (mantis::fs::FileExists(filename.c_str())) {
+        std::remove(filename.c_str());
+    }
+}
+
 /**
  * iterates over all elements of CQF,
  * find all the existing neighbors, and build a color graph based on that
@@ -83,12 +290,17 @@ bool MST::buildEdgeSets() {
 
     logger->info("Reading colored dbg from disk.");
     std::string cqf_file(prefix + mantis::CQF_FILE);
+    if (!mantis::fs::FileExists(cqf_file.c_str())) {
+        logger->error("{} not found. The MST of an index built with --static-map "
+                      "has to be built during the build (mantis build --mst).", cqf_file);
+        std::exit(1);
+    }
     CQF<KeyObject> cqf(cqf_file, CQF_FREAD);
     k = cqf.keybits() / 2;
     logger->info("Done loading cdbg. k is {}", k);
     logger->info("Iterating over cqf & building edgeSet ...");
     // max possible value and divisible by 64
-    sdsl::bit_vector nodes((1 + (num_of_ccBuffers * mantis::NUM_BV_BUFFER) / 64) * 64, 0);
+    sdsl::bit_vector nodes((1 + (num_of_ccBuffers * bvBufferSize) / 64) * 64, 0);
     uint64_t maxId{0}, numOfKmers{0};
 
     // build color class edges in a multi-threaded manner
@@ -116,29 +328,51 @@ bool MST::buildEdgeSets() {
     if (lastbits != maxId - maxIdDivisibleBy64)
         logger->error("Didn't see one of the color classes in the CQF between {} & {}", i, maxId);*/
     num_colorClasses = maxId + 1;
-    logger->info("Put edges in each bucket in a sorted list.");
+    std::vector<std::string> edgeFiles;
     for (uint32_t i = 0; i < nThreads; ++i) {
-        std::string filename = "tmp"+std::to_string(i);
+        edgeFiles.push_back("tmp"+std::to_string(i));
+    }
+    bucketEdges(edgeFiles);
+    return true;
+}
+
+/**
+ * reads the edges of the color graph from the temporary edge files,
+ * puts them in the bucket of their pair of color class buffers as a sorted list,
+ * and adds an edge between each color class and the dummy node zero
+ * @param edgeFiles each starting with the number of edges followed by the edges
+ */
+void MST::bucketEdges(const std::vector<std::string> &edgeFiles) {
+    logger->info("Put edges in each bucket in a sorted list.");
+    std::vector<Edge> edgeList;
+    edgeList.reserve(mantis::MST_EDGE_IO_BATCH);
+    for (auto &filename : edgeFiles) {
         std::ifstream tmp;
         tmp.open(filename, std::ios::in | std::ios::binary);
         uint64_t cnt;
         tmp.read(reinterpret_cast<char *>(&cnt), sizeof(cnt));
-        std::vector<Edge> edgeList;
-        edgeList.resize(cnt);
-        tmp.read(reinterpret_cast<char *>(edgeList.data()), sizeof(Edge)*cnt);
+        // the edges are read a batch at a time, only the distinct ones of each
+        // batch are kept in the buckets
+        for (uint64_t read = 0; read < cnt; read += edgeList.size()) {
+            edgeList.resize(std::min(cnt - read, mantis::MST_EDGE_IO_BATCH));
+            if (!tmp.read(reinterpret_cast<char *>(edgeList.data()), sizeof(Edge) * edgeList.size())) {
+                logger->error("Could not read {} edges from {}", cnt, filename);
+                std::exit(1);
+            }
+            std::sort(edgeList.begin(), edgeList.end(),
+                      [](Edge &e1, Edge &e2) {
+                          return e1.n1 == e2.n1 ? e1.n2 < e2.n2 : e1.n1 < e2.n1;
+                      });
+            auto last = std::unique(edgeList.begin(), edgeList.end(),
+                                    [](Edge &e1, Edge &e2) {
+                                        return e1.n1 == e2.n1 and e1.n2 == e2.n2;
+                                    });
+            for (auto edge = edgeList.begin(); edge != last; ++edge) {
+                edgeBucketList[getBucketId(edge->n1, edge->n2)].push_back(*edge);
+            }
+        }
         tmp.close();
         std::remove(filename.c_str());
-        std::sort(edgeList.begin(), edgeList.end(),
-                  [](Edge &e1, Edge &e2) {
-                      return e1.n1 == e2.n1 ? e1.n2 < e2.n2 : e1.n1 < e2.n1;
-                  });
-        edgeList.erase(std::unique(edgeList.begin(), edgeList.end(),
-                [](Edge &e1, Edge &e2) {
-                    return e1.n1 == e2.n1 and e1.n2 == e2.n2;
-                }), edgeList.end());
-        for (auto &edge: edgeList) {
-            edgeBucketList[getBucketId(edge.n1, edge.n2)].push_back(edge);
-        }
     }
     for (auto &bucket: edgeBucketList) {
         std::cerr << "before uniqifying: " << bucket.size() << " ";
@@ -166,8 +400,6 @@ bool MST::buildEdgeSets() {
         edgeBucketList[getBucketId(colorId, zero)].push_back(Edge(colorId, zero));
     }
     num_colorClasses++; // zero is now a dummy color class with ID equal to actual num of color classes
-
-    return true;
 }
 
 void MST::buildPairedColorIdEdgesInParallel(uint32_t threadId,
@@ -184,10 +416,14 @@ void MST::buildPairedColorIdEdgesInParallel(uint32_t threadId,
                   << "sr" << (uint64_t) (startPoint%(__uint128_t)0xFFFFFFFFFFFFFFFF) << " "
                 << "e" << (uint64_t) (endPoint/(__uint128_t)0xFFFFFFFFFFFFFFFF) << " "
                 << "er" << (uint64_t) (endPoint%(__uint128_t)0xFFFFFFFFFFFFFFFF) << "\n";*/
+    // the distinct edges found since the last write to the thread's file
     auto tmpEdgeListSize = MAX_ALLOWED_TMP_EDGES / nThreads;
+    spp::sparse_hash_set<Edge, edge_hash> edgeSet;
     std::vector<Edge> edgeList;
-    edgeList.reserve(tmpEdgeListSize);
     auto it = cqf.setIteratorLimits(startPoint, endPoint);
+    auto findEdges = dna::with_kmer_length(k, [](auto K) {
+        return &MST::findNeighborEdges<decltype(K)::value>;
+    });
     std::string filename("tmp"+std::to_string(threadId));
     uint64_t cnt = 0;
     std::ofstream tmpfile;
@@ -195,15 +431,17 @@ void MST::buildPairedColorIdEdgesInParallel(uint32_t threadId,
     tmpfile.write(reinterpret_cast<const char *>(&cnt), sizeof(cnt));
     while (!it.reachedHashLimit()) {
         KeyObject keyObject = *it;
-        uint64_t curEqId = keyObject.count - 1;
+        uint64_t curEqId = dbg_eqclass(cqf, keyObject) - 1;
         //nodes[curEqId] = 1; // set the seen color class id bit
         localMaxId = curEqId > localMaxId ? curEqId : localMaxId;
         // Add an edge between the color class and each of its neighbors' colors in dbg
-        findNeighborEdges(cqf, keyObject, edgeList);
-        if (edgeList.size() >= tmpEdgeListSize/* and colorMutex.try_lock()*/) {
-            tmpfile.write(reinterpret_cast<const char *>(edgeList.data()), sizeof(Edge)*edgeList.size());
-            cnt+=edgeList.size();
-            edgeList.clear();
+        (this->*findEdges)(cqf, keyObject, edgeList);
+        edgeSet.insert(edgeList.begin(), edgeList.end());
+        edgeList.clear();
+        if (edgeSet.size() >= tmpEdgeListSize/* and colorMutex.try_lock()*/) {
+            writeEdges(tmpfile, edgeSet, edgeList);
+            cnt+=edgeSet.size();
+            edgeSet.clear();
         }
         ++it;
         kmerCntr++;
@@ -211,8 +449,8 @@ void MST::buildPairedColorIdEdgesInParallel(uint32_t threadId,
             std::cerr << "\rthread " << threadId << ": Observed " << (numOfKmers + kmerCntr) / 1000000 << "M kmers and " << cnt << " edges";
         }
     }
-    tmpfile.write(reinterpret_cast<const char *>(edgeList.data()), sizeof(Edge)*edgeList.size());
-    cnt+=edgeList.size();
+    writeEdges(tmpfile, edgeSet, edgeList);
+    cnt+=edgeSet.size();
     colorMutex.lock();
     maxId = localMaxId > maxId ? localMaxId : maxId;
     numOfKmers += kmerCntr;
@@ -225,6 +463,24 @@ void MST::buildPairedColorIdEdgesInParallel(uint32_t threadId,
     tmpfile.close();
 }
 
+/**
+ * writes the edges of edgeSet to an edge file, through the buffer edgeList
+ */
+void MST::writeEdges(std::ofstream &file, const spp::sparse_hash_set<Edge, edge_hash> &edgeSet,
+                     std::vector<Edge> &edgeList) {
+    auto write = [&]() {
+        file.write(reinterpret_cast<const char *>(edgeList.data()), sizeof(Edge)*edgeList.size());
+        edgeList.clear();
+    };
+    for (auto &edge : edgeSet) {
+        edgeList.push_back(edge);
+        if (edgeList.size() == mantis::MST_EDGE_IO_BATCH) {
+            write();
+        }
+    }
+    write();
+}
+
 /**
  * loads the color class table in parts
  * calculate the hamming distance between the color bitvectors fetched from color class table
@@ -238,6 +494,10 @@ bool MST::calculateWeights() {
     logger->info("Going over all the edges and calculating the weights.");
     uint64_t numEdges = 0;
     weightBuckets.resize(numSamples);
+    // per edge weight of the current edge bucket and
+    // per thread histogram of the weights (later turned into the thread's write offsets)
+    std::vector<uint32_t> edgeWeights;
+    std::vector<std::vector<uint64_t>> threadWeightOffsets(nThreads, std::vector<uint64_t>(numSamples, 0));
     for (auto i = 0; i < eqclass_files.size(); i++) {
         BitVectorRRR bv1;
         sdsl::load_from_file(bv1, eqclass_files[i]);
@@ -252,13 +512,40 @@ bool MST::calculateWeights() {
                 bvp2 = &bv2;
             }
             std::cerr << "\rEq classes " << i << " and " << j << " -> edgeset size: " << edgeBucket.size();
+            edgeWeights.resize(edgeBucket.size());
+            for (auto &cnts : threadWeightOffsets) {
+                std::fill(cnts.begin(), cnts.end(), 0);
+            }
+            // 1. each thread calculates the weights of its own range of edges
             std::vector<std::thread> threads;
             for (uint32_t t = 0; t < nThreads; ++t) {
                 threads.emplace_back(std::thread(&MST::calcHammingDistInParallel, this, t,
-                                                 std::ref(edgeBucket)));
+                                                 std::ref(edgeBucket), std::ref(edgeWeights),
+                                                 std::ref(threadWeightOffsets[t])));
             }
             for (auto &t : threads) { t.join(); }
+            // 2. prefix sum over (weight, thread) to reserve a disjoint range
+            // in each weight bucket for every thread
+            for (uint64_t w = 0; w < numSamples; w++) {
+                uint64_t offset = weightBuckets[w].size();
+                for (auto &cnts : threadWeightOffsets) {
+                    uint64_t cnt = cnts[w];
+                    cnts[w] = offset;
+                    offset += cnt;
+                }
+                weightBuckets[w].resize(offset);
+            }
+            // 3. each thread scatters its edges into its reserved ranges without locking
+            threads.clear();
+            for (uint32_t t = 0; t < nThreads; ++t) {
+                threads.emplace_back(std::thread(&MST::scatterEdgesInParallel, this, t,
+                                                 std::ref(edgeBucket), std::ref(edgeWeights),
+                                                 std::ref(threadWeightOffsets[t])));
+            }
+            for (auto &t : threads) { t.join(); }
+            numEdges += edgeBucket.size();
             edgeBucket.clear();
+            edgeBucket.shrink_to_fit();
         }
     }
     std::cerr << "\r";
@@ -271,45 +558,60 @@ bool MST::calculateWeights() {
         delete bvp2;
     }*/
     edgeBucketList.clear();
-    logger->info("Calculated the weight for the edges");
+    logger->info("Calculated the weight for {} edges", numEdges);
     return true;
 }
 
-void MST::calcHammingDistInParallel(uint32_t i, std::vector<Edge> &edgeList) {
+/**
+ * the range of edges in the list of size listSize that thread i is responsible for
+ * If the list contains less than a hundred edges, don't bother with multi-threading and
+ * just run the first thread
+ */
+std::pair<uint64_t, uint64_t> MST::getThreadEdgeRange(uint32_t i, uint64_t listSize) {
+    if (listSize < 100) {
+        return i == 0 ? std::make_pair(static_cast<uint64_t>(0), listSize) :
+               std::make_pair(listSize, listSize);
+    }
+    return std::make_pair(listSize * i / nThreads, listSize * (i + 1) / nThreads);
+}
+
+/**
+ * calculates the weight of the edges in thread i's range of edgeList
+ * @param edgeWeights (output) weight of each edge, only the thread's range is written
+ * @param weightCnts (output) number of edges of the thread in each weight bucket
+ */
+void MST::calcHammingDistInParallel(uint32_t i, std::vector<Edge> &edgeList,
+                                    std::vector<uint32_t> &edgeWeights,
+                                    std::vector<uint64_t> &weightCnts) {
     uint64_t srcId = (uint64_t)-1;
     std::vector<uint64_t> srcBV;
-    std::vector<std::vector<Edge>> localWeightBucket;
-    localWeightBucket.resize(numSamples);
-    uint64_t s = 0, e = edgeList.size();
-    // If the list contains less than a hundred edges, don't bother with multi-threading and
-    // just run the first thread
-   if (edgeList.size() < 100) {
-        if (i == 0) {
-            e = edgeList.size();
-        } else {
-            e = 0;
-        }
-    } else {
-        s = edgeList.size() * i / nThreads;
-        e = edgeList.size() * (i + 1) / nThreads;
-    }
-    auto itrStart = edgeList.begin() + s;
-    auto itrEnd = e >= edgeList.size() ? edgeList.end() : edgeList.begin() + e;
-    //logger->info("Thread {}: {} to {} out of {}", i, s, e, edgeList.size());
-    for (auto edge = itrStart; edge != itrEnd; edge++) {
-        auto w = hammingDist(edge->n1, edge->n2,
+    auto range = getThreadEdgeRange(i, edgeList.size());
+    //logger->info("Thread {}: {} to {} out of {}", i, range.first, range.second, edgeList.size());
+    for (uint64_t idx = range.first; idx < range.second; idx++) {
+        auto &edge = edgeList[idx];
+        auto w = hammingDist(edge.n1, edge.n2,
                              srcId, srcBV); // hammingDist uses bvp1 and bvp2
         if (w == 0) {
-            logger->error("Hamming distance of 0 between edges {} & {}", edge->n1, edge->n2);
+            logger->error("Hamming distance of 0 between edges {} & {}", edge.n1, edge.n2);
             std::exit(1);
         }
-        localWeightBucket[w - 1].push_back(*edge);
+        edgeWeights[idx] = static_cast<uint32_t>(w);
+        weightCnts[w - 1]++;
     }
-    colorMutex.lock();
-    for (uint64_t j = 0; j < numSamples; j++) {
-        weightBuckets[j].insert(weightBuckets[j].end(), localWeightBucket[j].begin(), localWeightBucket[j].end());
+}
+
+/**
+ * copies the edges in thread i's range of edgeList to the weight buckets
+ * @param weightOffsets the first slot reserved for the thread in each weight bucket
+ */
+void MST::scatterEdgesInParallel(uint32_t i, std::vector<Edge> &edgeList,
+                                 std::vector<uint32_t> &edgeWeights,
+                                 std::vector<uint64_t> &weightOffsets) {
+    auto range = getThreadEdgeRange(i, edgeList.size());
+    for (uint64_t idx = range.first; idx < range.second; idx++) {
+        auto w = edgeWeights[idx] - 1;
+        weightBuckets[w][weightOffsets[w]++] = edgeList[idx];
     }
-    colorMutex.unlock();
 }
 
 /**
@@ -321,7 +623,11 @@ void MST::calcHammingDistInParallel(uint32_t i, std::vector<Edge> &edgeList) {
  */
 DisjointSets MST::kruskalMSF() {
     uint32_t bucketCnt = numSamples;
-    mst.resize(num_colorClasses);
+    // selected edges and their weights, compacted into the CSR adjacency at the end
+    std::vector<Edge> mstEdges;
+    std::vector<uint32_t> mstEdgeWeights;
+    mstEdges.reserve(num_colorClasses - 1);
+    mstEdgeWeights.reserve(num_colorClasses - 1);
     // Create disjoint sets
     DisjointSets ds(num_colorClasses);
 
@@ -344,8 +650,8 @@ DisjointSets MST::kruskalMSF() {
                 // Merge two sets
                 ds.merge(root_of_u, root_of_v, w);
                 // Current edge will be in the MST
-                mst[u].emplace_back(v, w);
-                mst[v].emplace_back(u, w);
+                mstEdges.push_back(it);
+                mstEdgeWeights.push_back(w);
                 mstTotalWeight += w;
                 selectedEdgeCntr++;
             }
@@ -356,9 +662,10 @@ DisjointSets MST::kruskalMSF() {
             }
             edgeIdxInBucket++;
         }
-        weightBuckets[bucketCntr].clear();
+        std::vector<Edge>().swap(weightBuckets[bucketCntr]);
     }
     std::cerr << "\r";
+    mst.build(num_colorClasses, mstEdges, mstEdgeWeights);
     mstTotalWeight++;//1 empty slot for root (zero)
     logger->info("MST Construction finished:"
                  "\n\t# of graph edges: {}"
@@ -370,20 +677,18 @@ DisjointSets MST::kruskalMSF() {
 
 /**
  * calls kruskal algorithm to build an MST of the color graph
- * goes over the MST and fills in the int-vectors parentbv, bbv, and deltabv
- * serializes these three int-vectors as the encoding of color classes
- * @return true if encoding and serializing the DS is successful
+ * goes over the MST and fills in parentbv and the boundaries of the deltas in bbv
  */
-bool MST::encodeColorClassUsingMST() {
+void MST::buildParentBV() {
     // build mst of color class graph
     kruskalMSF();
 
     uint64_t nodeCntr{0};
     // encode the color classes using mst
     logger->info("Filling ParentBV...");
-    sdsl::int_vector<> parentbv(num_colorClasses, 0, ceil(log2(num_colorClasses)));
+    parentbv = sdsl::int_vector<>(num_colorClasses, 0, ceil(log2(num_colorClasses)));
     // create and fill the deltabv and boundarybv data structures
-    sdsl::bit_vector bbv(mstTotalWeight, 0);
+    bbv = sdsl::bit_vector(mstTotalWeight, 0);
     {// putting weightbv inside the scope so its memory is freed after we're done with it
         sdsl::int_vector<> weightbv(num_colorClasses, 0, ceil(log2(numSamples)));
         sdsl::bit_vector visited(num_colorClasses, 0);
@@ -395,11 +700,12 @@ bool MST::encodeColorClassUsingMST() {
         while (!q.empty()) {
             colorIdType parent = q.front();
             q.pop();
-            for (auto &neighbor :mst[parent]) {
-                if (!visited[neighbor.first]) {
-                    parentbv[neighbor.first] = parent;
-                    weightbv[neighbor.first] = neighbor.second;
-                    q.push(neighbor.first);
+            for (auto n = mst.begin(parent); n < mst.end(parent); n++) {
+                colorIdType neighbor = mst.neighbors[n];
+                if (!visited[neighbor]) {
+                    parentbv[neighbor] = parent;
+                    weightbv[neighbor] = mst.weights[n];
+                    q.push(neighbor);
                 }
             }
             visited[parent] = 1;
@@ -408,6 +714,7 @@ bool MST::encodeColorClassUsingMST() {
                 std::cerr << "\rset parent of " << nodeCntr << " ccs";
             }
         }
+        mst.clear();
 
         std::cerr << "\r";
         // filling bbv
@@ -424,16 +731,53 @@ bool MST::encodeColorClassUsingMST() {
             bbv[deltaOffset - 1] = 1;
         }
     }
+}
+
+/**
+ * calls kruskal algorithm to build an MST of the color graph
+ * goes over the MST and fills in the int-vectors parentbv, bbv, and deltabv
+ * serializes these three int-vectors as the encoding of color classes
+ * @param parentsLoaded true if parentbv and bbv are already loaded from a checkpoint
+ * @return true if encoding and serializing the DS is successful
+ */
+bool MST::encodeColorClassUsingMST(bool parentsLoaded) {
+    if (!parentsLoaded) {
+        buildParentBV();
+        storeCheckpoint(MSTPhase::parents);
+        removeCheckpoint(MSTPhase::weights);
+    }
     std::cerr << "\r";
     // fill in deltabv
     logger->info("Filling DeltaBV...");
     sdsl::int_vector<> deltabv(mstTotalWeight, 0, ceil(log2(numSamples)));
     sdsl::bit_vector::select_1_type sbbv = sdsl::bit_vector::select_1_type(&bbv);
+    // assign each node to the buffer pair of its (node, parent) edge in a single pass (counting sort)
+    // nodes of each buffer pair are then sorted by id and so are their delta offsets
+    // (the root, zero, has no deltas and is skipped)
+    std::vector<uint64_t> bucketStart(num_of_ccBuffers * num_of_ccBuffers + 1, 0);
+    for (colorIdType p = 0; p < zero; p++) {
+        bucketStart[getBucketId(p, parentbv[p]) + 1]++;
+    }
+    for (uint64_t b = 1; b < bucketStart.size(); b++) {
+        bucketStart[b] += bucketStart[b - 1];
+    }
+    std::vector<colorIdType> bucketNodes(zero);
+    {
+        std::vector<uint64_t> nextSlot(bucketStart.begin(), bucketStart.end() - 1);
+        for (colorIdType p = 0; p < zero; p++) {
+            bucketNodes[nextSlot[getBucketId(p, parentbv[p])]++] = p;
+        }
+    }
+    std::vector<std::vector<std::pair<uint64_t, uint32_t>>> threadSpills(nThreads);
     for (auto i = 0; i < eqclass_files.size(); i++) {
         BitVectorRRR bv1;
         sdsl::load_from_file(bv1, eqclass_files[i]);
         bvp1 = &bv1;
         for (auto j = i; j < eqclass_files.size(); j++) {
+            uint64_t bucketId = i * num_of_ccBuffers + j;
+            if (bucketStart[bucketId] == bucketStart[bucketId + 1]) {
+                continue;
+            }
             BitVectorRRR bv2;
             if (i == j) {
                 bvp2 = bvp1;
@@ -444,10 +788,19 @@ bool MST::encodeColorClassUsingMST() {
             std::vector<std::thread> threads;
             for (uint32_t t = 0; t < nThreads; ++t) {
                 threads.emplace_back(std::thread(&MST::calcDeltasInParallel, this,
-                        t, i, j,
-                        std::ref(parentbv), std::ref(deltabv), std::ref(sbbv)));
+                        t, bucketNodes.begin() + bucketStart[bucketId],
+                        bucketNodes.begin() + bucketStart[bucketId + 1],
+                        std::ref(deltabv), std::ref(sbbv),
+                        std::ref(threadSpills[t])));
             }
             for (auto &t : threads) { t.join(); }
+            // write the deltas that share a word with the previous thread's range
+            for (auto &spill : threadSpills) {
+                for (auto &d : spill) {
+                    deltabv[d.first] = d.second;
+                }
+                spill.clear();
+            }
         }
     }
     std::cerr << "\r";
@@ -462,96 +815,171 @@ bool MST::encodeColorClassUsingMST() {
 */
     logger->info("Serializing data structures parentbv, deltabv, & bbv...");
     sdsl::store_to_file(parentbv, std::string(prefix + mantis::PARENTBV_FILE));
-    sdsl::store_to_file(deltabv, std::string(prefix + mantis::DELTABV_FILE));
-    sdsl::store_to_file(bbv, std::string(prefix + mantis::BOUNDARYBV_FILE));
+    // only one encoding of the deltas is kept in the index
+    if (gapEncodeDeltas and storeGapEncodedDeltas(deltabv)) {
+        std::remove(std::string(prefix + mantis::DELTABV_FILE).c_str());
+        std::remove(std::string(prefix + mantis::BOUNDARYBV_FILE).c_str());
+    } else {
+        sdsl::store_to_file(deltabv, std::string(prefix + mantis::DELTABV_FILE));
+        sdsl::store_to_file(bbv, std::string(prefix + mantis::BOUNDARYBV_FILE));
+        std::remove(std::string(prefix + mantis::DELTAVB_FILE).c_str());
+        std::remove(std::string(prefix + mantis::BOUNDARYVB_FILE).c_str());
+    }
     logger->info("Done Serializing.");
     return true;
 }
 
-void MST::calcDeltasInParallel(uint32_t threadID, uint64_t cbvID1, uint64_t cbvID2,
-                               sdsl::int_vector<> &parentbv, sdsl::int_vector<> &deltabv,
-                               sdsl::bit_vector::select_1_type &sbbv ) {
-
-    struct Delta {
-        uint64_t startingOffset{0};
-        std::vector<uint32_t> deltaVals;
-        Delta() = default;
-
-        Delta(uint64_t so) {
-            startingOffset = so;
+/**
+ * re-encodes the fixed-width deltas of each node as the gaps between its (sorted) deltas,
+ * each gap written as a variable-byte code (7 bits per byte, high bit set if more bytes follow)
+ * The boundary bv then marks the last byte of each node's delta list
+ * The sizes of both encodings and the time to decode all the lists from each are logged,
+ * and the gap-encoded lists are only stored if they are smaller
+ * @param deltabv fixed-width deltas delimited by bbv
+ * @return true if the gap-encoded lists were stored
+ */
+bool MST::storeGapEncodedDeltas(sdsl::int_vector<> &deltabv) {
+    auto vbyteLen = [](uint64_t v) {
+        uint64_t len = 1;
+        while (v >= 0x80) {
+            v >>= 7;
+            len++;
         }
+        return len;
     };
-    std::vector<Delta> deltas;
-
-    colorIdType s = parentbv.size() * threadID / nThreads;
-    colorIdType e = parentbv.size() * (threadID+1) / nThreads;
-    for (colorIdType p = s; p < e; p++) {
-        if (getBucketId(p, parentbv[p]) == cbvID1 * num_of_ccBuffers + cbvID2) {
-            auto deltaOffset = (p > 0) ? (sbbv(p) + 1) : 0;
-            deltas.push_back(deltaOffset);
-            deltas.back().deltaVals = getDeltaList(p, parentbv[p]);
+    // first pass to find the size of the encoding
+    uint64_t numBytes{0}, prev{0};
+    for (uint64_t i = 0; i < deltabv.size(); i++) {
+        numBytes += vbyteLen(deltabv[i] - prev);
+        prev = bbv[i] ? 0 : static_cast<uint64_t>(deltabv[i]);
+    }
+    sdsl::int_vector<8> deltavb(numBytes, 0);
+    sdsl::bit_vector bbvb(numBytes, 0);
+    uint64_t j{0};
+    prev = 0;
+    for (uint64_t i = 0; i < deltabv.size(); i++) {
+        uint64_t gap = deltabv[i] - prev;
+        while (gap >= 0x80) {
+            deltavb[j++] = static_cast<uint8_t>((gap & 0x7f) | 0x80);
+            gap >>= 7;
+        }
+        deltavb[j++] = static_cast<uint8_t>(gap);
+        if (bbv[i]) {
+            bbvb[j - 1] = 1;
+            prev = 0;
+        } else {
+            prev = deltabv[i];
         }
     }
-    colorMutex.lock();
-    for (auto &v : deltas) {
-        for (auto cntr = 0; cntr < v.deltaVals.size(); cntr++)
-            deltabv[v.startingOffset+cntr] = v.deltaVals[cntr];
+    uint64_t fixedBytes = sdsl::size_in_bytes(deltabv) + sdsl::size_in_bytes(bbv);
+    uint64_t gapBytes = sdsl::size_in_bytes(deltavb) + sdsl::size_in_bytes(bbvb);
+    logger->info("Delta lists: {} bytes with fixed {}-bit entries, {} bytes gap-encoded ({} bytes of boundaries)",
+                 fixedBytes, static_cast<uint32_t>(deltabv.width()), gapBytes, sdsl::size_in_bytes(bbvb));
+
+    // decode every list of both encodings into the sample flips, as the queries do
+    std::vector<uint32_t> fixedFlips(numSamples, 0), gapFlips(numSamples, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < deltabv.size(); i++) {
+        fixedFlips[deltabv[i]] ^= 0x01;
     }
-    colorMutex.unlock();
+    auto fixedTime = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    uint64_t delta{0}, gap{0}, shift{0};
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(deltavb.data());
+    for (uint64_t i = 0; i < numBytes; i++) {
+        gap |= static_cast<uint64_t>(bytes[i] & 0x7f) << shift;
+        if (bytes[i] & 0x80) {
+            shift += 7;
+        } else {
+            delta += gap;
+            gapFlips[delta] ^= 0x01;
+            gap = 0;
+            shift = 0;
+        }
+        if (bbvb[i]) {
+            delta = 0;
+        }
+    }
+    auto gapTime = std::chrono::steady_clock::now() - start;
+    if (fixedFlips != gapFlips) {
+        logger->error("The gap-encoded delta lists don't decode to the fixed-width ones.");
+        std::exit(1);
+    }
+    logger->info("Decoding all the delta lists: {:.2f} ms with fixed-width entries, {:.2f} ms gap-encoded",
+                 std::chrono::duration<double, std::milli>(fixedTime).count(),
+                 std::chrono::duration<double, std::milli>(gapTime).count());
 
+    if (gapBytes >= fixedBytes) {
+        logger->info("Keeping the fixed-width delta lists, which are smaller.");
+        return false;
+    }
+    sdsl::store_to_file(deltavb, std::string(prefix + mantis::DELTAVB_FILE));
+    sdsl::store_to_file(bbvb, std::string(prefix + mantis::BOUNDARYVB_FILE));
+    return true;
 }
+
 /**
- * finds the neighbors of each kmer in the cqf,
- * and adds an edge of the element's colorId and its neighbor's
- * @param cqf (required to query for existence of neighbors)
- * @param it iterator to the elements of cqf
+ * calculates the delta lists of thread threadID's share of the nodes in [nodesBegin, nodesEnd)
+ * and writes them directly to deltabv.
+ * Nodes are sorted so each thread owns a contiguous range of deltabv.
+ * Deltas that fall in the first 64 entries block of the thread's range
+ * may share a word with the previous thread and are returned in spill to be written after the join.
  */
-void MST::findNeighborEdges(CQF<KeyObject> &cqf, KeyObject &keyobj, std::vector<Edge> &edgeList) {
-    dna::canonical_kmer curr_node(static_cast<int>(k), keyobj.key);
-    workItem cur = {curr_node, static_cast<colorIdType>(keyobj.count - 1)};
-    uint64_t neighborCnt{0};
-    for (auto &nei : neighbors(cqf, cur)) {
-        neighborCnt++;
-        if (cur.colorId < nei.colorId) {
-            Edge e(static_cast<colorIdType>(cur.colorId), static_cast<colorIdType>(nei.colorId));
-            edgeList.push_back(e);
+void MST::calcDeltasInParallel(uint32_t threadID,
+                               std::vector<colorIdType>::const_iterator nodesBegin,
+                               std::vector<colorIdType>::const_iterator nodesEnd,
+                               sdsl::int_vector<> &deltabv,
+                               sdsl::bit_vector::select_1_type &sbbv,
+                               std::vector<std::pair<uint64_t, uint32_t>> &spill) {
+    uint64_t nodeCnt = std::distance(nodesBegin, nodesEnd);
+    auto s = nodesBegin + nodeCnt * threadID / nThreads;
+    auto e = nodesBegin + nodeCnt * (threadID + 1) / nThreads;
+    if (s == e) return;
+    // 64 entries of deltabv always end on a word boundary, whatever the width is
+    uint64_t firstOwnedIdx = ((((*s) > 0) ? (sbbv(*s) + 1) : 0) + 63) / 64 * 64;
+    for (auto it = s; it != e; it++) {
+        colorIdType p = *it;
+        auto deltaOffset = (p > 0) ? (sbbv(p) + 1) : 0;
+        auto deltaVals = getDeltaList(p, parentbv[p]);
+        for (auto cntr = 0; cntr < deltaVals.size(); cntr++) {
+            if (deltaOffset + cntr < firstOwnedIdx) {
+                spill.emplace_back(deltaOffset + cntr, deltaVals[cntr]);
+            } else {
+                deltabv[deltaOffset + cntr] = deltaVals[cntr];
+            }
         }
     }
 }
 
 /**
- * finds neighbors of a node in cqf
- * @param cqf
- * @param n : work_item containing node and colorId (colorId will be filled)
- * @return set of neighbors for current node n and their colorIds
+ * finds the neighbors of each kmer in the cqf,
+ * and adds an edge of the element's colorId and its neighbor's
+ * @tparam K k of the index
+ * @param cqf (required to query for existence of neighbors)
+ * @param keyobj the kmer and its colorId + 1
  */
-std::set<workItem> MST::neighbors(CQF<KeyObject> &cqf, workItem n) {
-    std::set<workItem> result;
-    for (const auto b : dna::bases) {
+template <uint32_t K>
+void MST::findNeighborEdges(CQF<KeyObject> &cqf, KeyObject &keyobj, std::vector<Edge> &edgeList) {
+    auto curColorId = static_cast<colorIdType>(dbg_eqclass(cqf, keyobj) - 1);
+    dna::fixed_kmer<K>::for_each_neighbor(dna::fixed_kmer<K>::canonicalize(keyobj.key), [&](uint64_t nei) {
         uint64_t eqid = 0;
-        if (exists(cqf, n.node << b, eqid)) {
-            if (eqid != n.colorId)
-                result.insert(workItem(n.node << b, eqid));
-        }
-        if (exists(cqf, b >> n.node, eqid)) {
-            if (eqid != n.colorId)
-                result.insert(workItem(b >> n.node, eqid));
+        if (exists(cqf, nei, eqid) and curColorId < eqid) {
+            edgeList.emplace_back(curColorId, static_cast<colorIdType>(eqid));
         }
-    }
-    return result;
+    });
 }
 
 /**
  * searches for a kmer in cqf and returns the correct colorId if found
- * which is cqf count value - 1
+ * which is its eq class - 1
  * @param cqf
- * @param e : search canonical kmer
+ * @param kmer : search canonical kmer
  * @param eqid : reference to eqid that'll be set
  * @return true if eqid is found
  */
-bool MST::exists(CQF<KeyObject> &cqf, dna::canonical_kmer e, uint64_t &eqid) {
-    KeyObject key(e.val, 0, 0);
-    auto eqidtmp = cqf.query(key, QF_NO_LOCK /*QF_KEY_IS_HASH | QF_NO_LOCK*/);
+bool MST::exists(CQF<KeyObject> &cqf, uint64_t kmer, uint64_t &eqid) {
+    KeyObject key(kmer, 0, 0);
+    auto eqidtmp = dbg_eqclass(cqf, key, QF_NO_LOCK /*QF_KEY_IS_HASH | QF_NO_LOCK*/);
     if (eqidtmp) {
         eqid = eqidtmp - 1;
         return true;
@@ -635,7 +1063,7 @@ void MST::buildColor(std::vector<uint64_t> &eq, uint64_t eqid, BitVectorRRR *bv)
      }
      colorMutex.unlock();*/
     uint64_t i{0}, bitcnt{0}, wrdcnt{0};
-    uint64_t offset = eqid % mantis::NUM_BV_BUFFER;
+    uint64_t offset = eqid % bvBufferSize;
     while (i < numSamples) {
         bitcnt = std::min(numSamples - i, (uint64_t) 64);
         uint64_t wrd = bv->get_int(offset * numSamples + i, bitcnt);
@@ -657,8 +1085,8 @@ inline uint64_t MST::getBucketId(uint64_t c1, uint64_t c2) {
     if (c1 == zero or c1 > c2) {
         std::swap(c1, c2);
     }
-    uint64_t cb1 = c1 / mantis::NUM_BV_BUFFER;
-    uint64_t cb2 = c2 / mantis::NUM_BV_BUFFER;
+    uint64_t cb1 = c1 / bvBufferSize;
+    uint64_t cb2 = c2 / bvBufferSize;
     if (c2 == zero) // return the corresponding buffer for the non-zero colorId
         return cb1 * num_of_ccBuffers + cb1;
     return cb1 * num_of_ccBuffers + cb2;
@@ -669,7 +1097,10 @@ inline uint64_t MST::getBucketId(uint64_t c1, uint64_t c2) {
  * main function to call Color graph and MST construction and color class encoding and serializing
  */
 int build_mst_main(QueryOpts &opt) {
-    MST mst(opt.prefix, opt.console, opt.numThreads);
+    MST mst(opt.prefix, opt.console, opt.numThreads, opt.resume_mst);
+    if (opt.gap_encode_deltas) {
+        mst.setGapEncodeDeltas();
+    }
     mst.buildMST();
     if (opt.remove_colorClasses && !opt.keep_colorclasses) {
         for (auto &f : mantis::fs::GetFilesExt(opt.prefix.c_str(), mantis::EQCLASS_FILE)) {
@@ -2,27 +2,65 @@
 // Created by Fatemeh Almodaresi on 2018-10-15.
 //
 #include <fstream>
+#include <memory>
 #include <vector>
 #include <CLI/Timer.hpp>
 #include <canonicalKmer.h>
 #include <sparsepp/spp.h>
 
+#include "MantisFS.h"
 #include "ProgOpts.h"
 #include "kmer.h"
 #include "mstQuery.h"
+#include "dbgColorIds.h"
+#include "queryWriter.h"
 
 void MSTQuery::loadIdx(std::string indexDir) {
     sdsl::load_from_file(parentbv, indexDir + mantis::PARENTBV_FILE);
-    sdsl::load_from_file(deltabv, indexDir + mantis::DELTABV_FILE);
-    sdsl::load_from_file(bbv, indexDir + mantis::BOUNDARYBV_FILE);
+    gapEncodedDeltas = mantis::fs::FileExists((indexDir + mantis::DELTAVB_FILE).c_str());
+    if (gapEncodedDeltas) {
+        sdsl::load_from_file(deltavb, indexDir + mantis::DELTAVB_FILE);
+        sdsl::load_from_file(bbv, indexDir + mantis::BOUNDARYVB_FILE);
+    } else {
+        sdsl::load_from_file(deltabv, indexDir + mantis::DELTABV_FILE);
+        sdsl::load_from_file(bbv, indexDir + mantis::BOUNDARYBV_FILE);
+    }
     sbbv = sdsl::bit_vector::select_1_type(&bbv);
     zero = parentbv.size() - 1; // maximum color id which
     logger->info("Loaded the new color class index");
     logger->info("\t--> parent size: {}", parentbv.size());
-    logger->info("\t--> delta size: {}", deltabv.size());
+    if (gapEncodedDeltas) {
+        logger->info("\t--> gap-encoded delta size: {} bytes", deltavb.size());
+    } else {
+        logger->info("\t--> delta size: {}", deltabv.size());
+    }
     logger->info("\t--> boundary size: {}", bbv.size());
 }
 
+/**
+ * backs parentbv, the deltas and bbv with transparent huge pages
+ * sdsl allocates the vectors itself, so they can't be put in hugetlb pages
+ * like the CQF; their pages are collapsed into huge pages after loading instead
+ */
+void MSTQuery::useHugePages() {
+    std::vector<std::pair<const void *, uint64_t>> vectors{
+            {parentbv.data(), parentbv.capacity() / 8},
+            {bbv.data(), bbv.capacity() / 8}};
+    if (gapEncodedDeltas) {
+        vectors.emplace_back(deltavb.data(), deltavb.capacity() / 8);
+    } else {
+        vectors.emplace_back(deltabv.data(), deltabv.capacity() / 8);
+    }
+    uint64_t totalBytes{0}, hugeBytes{0};
+    for (auto &v : vectors) {
+        advise_huge_pages(v.first, v.second);
+        totalBytes += v.second;
+        hugeBytes += anon_huge_page_bytes(v.first, v.second);
+    }
+    logger->info("Color index: {:.1f} of {:.1f} MiB in transparent huge pages",
+                 hugeBytes / 1048576.0, totalBytes / 1048576.0);
+}
+
 std::vector<uint64_t> MSTQuery::buildColor(uint64_t eqid, QueryStats &queryStats,
                                            LRUCacheMap *lru_cache,
                                            RankScores *rs,
@@ -76,24 +114,55 @@ std::vector<uint64_t> MSTQuery::buildColor(uint64_t eqid, QueryStats &queryStats
     }
     uint64_t pctr{0};
     //std::cerr << "\n\nnext step:\n";
-    for (auto f : froms) {
-        bool found = false;
-        uint64_t wrd{0};
-        uint64_t offset{0};
-        auto start = f;
-        //std::cerr << "\n" << start << ": ";
-        do {
-            wrd = bbv.get_int(start, 64);
-            for (uint64_t j = 0; j < 64; j++) {
-                //std::cerr << deltabv[start + j] << " ";
-                flips[deltabv[start + j]] ^= 0x01;
-                if ((wrd >> j) & 0x01) {
-                    found = true;
-                    break;
+    if (gapEncodedDeltas) {
+        // each delta is the sum of the gaps read so far in the list of the node
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(deltavb.data());
+        for (auto f : froms) {
+            bool found = false;
+            uint64_t wrd{0};
+            uint64_t delta{0}, gap{0}, shift{0};
+            auto start = f;
+            do {
+                wrd = bbv.get_int(start, 64);
+                for (uint64_t j = 0; j < 64; j++) {
+                    uint8_t b = bytes[start + j];
+                    gap |= static_cast<uint64_t>(b & 0x7f) << shift;
+                    if (b & 0x80) {
+                        shift += 7;
+                    } else {
+                        delta += gap;
+                        flips[delta] ^= 0x01;
+                        gap = 0;
+                        shift = 0;
+                    }
+                    if ((wrd >> j) & 0x01) {
+                        found = true;
+                        break;
+                    }
                 }
-            }
-            start += 64;
-        } while (!found);
+                start += 64;
+            } while (!found);
+        }
+    } else {
+        for (auto f : froms) {
+            bool found = false;
+            uint64_t wrd{0};
+            uint64_t offset{0};
+            auto start = f;
+            //std::cerr << "\n" << start << ": ";
+            do {
+                wrd = bbv.get_int(start, 64);
+                for (uint64_t j = 0; j < 64; j++) {
+                    //std::cerr << deltabv[start + j] << " ";
+                    flips[deltabv[start + j]] ^= 0x01;
+                    if ((wrd >> j) & 0x01) {
+                        found = true;
+                        break;
+                    }
+                }
+                start += 64;
+            } while (!found);
+        }
     }
 
     std::vector<uint64_t> eq;
@@ -107,47 +176,67 @@ std::vector<uint64_t> MSTQuery::buildColor(uint64_t eqid, QueryStats &queryStats
     return eq;
 }
 
-void MSTQuery::findSamples(CQF<KeyObject> &dbg,
-                           LRUCacheMap &lru_cache,
-                           RankScores *rs,
-                           QueryStats &queryStats) {
-    mantis::EqMap query_eqclass_map;
-    std::unordered_set<uint64_t> query_eqclass_set;
+namespace {
+// the eq class of the k-mer in the dbg, 0 if it's not in it
+uint64_t queryEqClass(CQF<KeyObject> &dbg, const KeyObject &key) { return dbg_eqclass(dbg, key, 0); }
+uint64_t queryEqClass(StaticKmerMap &dbg, const KeyObject &key) { return dbg.query(key, 0); }
+}
+
+template <class DbgT>
+void MSTQuery::lookupKmers(DbgT &dbg) {
 //    std::cerr << "\n\nkmer2cidMap size: " << kmer2cidMap.size() << "\n\n";
     for (auto &kv : kmer2cidMap) {
         KeyObject key(kv.first, 0, 0);
 //        std::cerr << std::string(dna::canonical_kmer(dbg.keybits()/2, key.key)) << "\n";
-        uint64_t eqclass = dbg.query(key, 0);
+        uint64_t eqclass = queryEqClass(dbg, key);
         if (eqclass) {
             kv.second = eqclass - 1;
-            query_eqclass_set.insert(eqclass - 1);
         }
     }
+}
 
-    mantis::QueryResult sample_map(queryStats.numSamples, 0);
+const std::vector<uint64_t> &MSTQuery::decodeColor(uint64_t eqclass_id,
+                                                   LRUCacheMap &lru_cache,
+                                                   RankScores *rs,
+                                                   QueryStats &queryStats) {
+    auto decoded = cid2expMap.find(eqclass_id);
+    if (decoded != cid2expMap.end()) {
+        return decoded->second;
+    }
     nonstd::optional<uint64_t> toDecode{nonstd::nullopt};
     nonstd::optional<uint64_t> dummy{nonstd::nullopt};
 
-    for (auto &it : query_eqclass_set) {
-        uint64_t eqclass_id = it;
+    std::vector<uint64_t> setbits;
+    if (lru_cache.contains(eqclass_id)) {
+        setbits = lru_cache[eqclass_id];//.get(eqclass_id);
+        queryStats.cacheCntr++;
+    } else {
+        queryStats.noCacheCntr++;
+        queryStats.trySample = (queryStats.noCacheCntr % 10 == 0);
+        setbits = buildColor(eqclass_id, queryStats, &lru_cache, rs, toDecode);
+        lru_cache.emplace(eqclass_id, setbits);
+        if ((queryStats.trySample) and toDecode) {
+            auto s = buildColor(*toDecode, queryStats, nullptr, nullptr, dummy);
+            lru_cache.emplace(*toDecode, s);
+        }
+    }
+    return cid2expMap[eqclass_id] = std::move(setbits);
+}
 
-        std::vector<uint64_t> setbits;
-        if (lru_cache.contains(eqclass_id)) {
-            setbits = lru_cache[eqclass_id];//.get(eqclass_id);
-            queryStats.cacheCntr++;
-        } else {
-            queryStats.noCacheCntr++;
-            toDecode.reset();
-            dummy.reset();
-            queryStats.trySample = (queryStats.noCacheCntr % 10 == 0);
-            setbits = buildColor(eqclass_id, queryStats, &lru_cache, rs, toDecode);
-            lru_cache.emplace(eqclass_id, setbits);
-            if ((queryStats.trySample) and toDecode) {
-                auto s = buildColor(*toDecode, queryStats, nullptr, nullptr, dummy);
-                lru_cache.emplace(*toDecode, s);
-            }
+template <class DbgT>
+void MSTQuery::findSamples(DbgT &dbg,
+                           LRUCacheMap &lru_cache,
+                           RankScores *rs,
+                           QueryStats &queryStats) {
+    lookupKmers(dbg);
+    std::unordered_set<uint64_t> query_eqclass_set;
+    for (auto &kv : kmer2cidMap) {
+        if (kv.second != std::numeric_limits<uint64_t>::max()) {
+            query_eqclass_set.insert(kv.second);
         }
-        cid2expMap[eqclass_id] = setbits;
+    }
+    for (auto &it : query_eqclass_set) {
+        decodeColor(it, lru_cache, rs, queryStats);
         /*for (auto sb : setbits) {
             sample_map[sb] += count;
         }
@@ -156,205 +245,128 @@ void MSTQuery::findSamples(CQF<KeyObject> &dbg,
     }
 }
 
-
-void MSTQuery::parseKmers(std::string read, uint64_t kmer_size) {
-    //CLI::AutoTimer timer{"First round going over the file ", CLI::Timer::Big};
-    bool done = false;
-    while (!done and read.length() >= kmer_size) {
-        uint64_t first = 0;
-        uint64_t first_rev = 0;
-        uint64_t item = 0;
-        bool allNuclValid = true;
-        for (uint32_t i = 0; i < kmer_size; i++) { //First kmer
-            uint8_t curr = Kmer::map_base(read[i]);
-            if (curr > DNA_MAP::G) { // 'N' is encountered
-                if (i + 1 < read.length())
-                    read = read.substr(i + 1);
-                else
-                    done = true; // you've reached the end of a sequence (last nucl. is N)
-                allNuclValid = false;
-                break;
-            }
-            first = first | curr;
-            first = first << 2;
-        }
-        if (allNuclValid) {
-            first = first >> 2;
-            first_rev = static_cast<uint64_t >(Kmer::reverse_complement(first, kmer_size));
-
-            //cout << "kmer: "; cout << int_to_str(first);
-            //cout << " reverse-comp: "; cout << int_to_str(first_rev) << endl;
-
-            if (Kmer::compare_kmers(first, first_rev))
-                item = first;
-            else
-                item = first_rev;
-            kmer2cidMap[item] = std::numeric_limits<uint64_t>::max();
-
-            uint64_t next = (first << 2) & BITMASK(2 * kmer_size);
-            uint64_t next_rev = first_rev >> 2;
-            uint64_t i = 0;
-            for (i = kmer_size; i < read.length(); i++) { //next kmers
-                //cout << "K: " << read.substr(i-K+1,K) << endl;
-                uint8_t curr = Kmer::map_base(read[i]);
-                if (curr > DNA_MAP::G) { // 'N' is encountered
-                    if (i + 1 < read.length())
-                        read = read.substr(i + 1);
-                    else
-                        done = true;
-                    break;
-                }
-                next |= curr;
-                auto tmp = static_cast<uint64_t>(Kmer::reverse_complement_base(curr));
-                tmp <<= (kmer_size * 2 - 2);
-                next_rev = next_rev | tmp;
-                if (Kmer::compare_kmers(next, next_rev))
-                    item = next;
-                else
-                    item = next_rev;
-                kmer2cidMap[item] = std::numeric_limits<uint64_t>::max();
-                next = (next << 2) & BITMASK(2 * kmer_size);
-                next_rev = next_rev >> 2;
-            }
-            if (i == read.length()) done = true;
+/**
+ * A color class is decoded only while a sample could still be reported through it, and
+ * then only once per read, as both its samples and the test of a sample need it.
+ */
+template <class DbgT>
+mantis::QueryResult &MSTQuery::findFilteredSamples(DbgT &dbg,
+                                                   LRUCacheMap &lru_cache,
+                                                   RankScores *rs,
+                                                   QueryStats &queryStats,
+                                                   const QueryFilter &filter) {
+    lookupKmers(dbg);
+    std::unordered_map<uint64_t, uint64_t> colorCounts;
+    for (auto& kv : kmer2cidMap) {
+        if (kv.second != std::numeric_limits<uint64_t>::max()) {
+            colorCounts[kv.second]++;
         }
     }
+    queryColors.clear();
+    for (auto& kv : colorCounts) {
+        queryColors.emplace_back(kv.second, kv.first);
+    }
+    countFilteredSamples(queryColors, kmer2cidMap.size(), filter, result, candidates,
+                         [&](uint64_t eqclass_id, auto fn) {
+                             for (auto sample : decodeColor(eqclass_id, lru_cache, rs, queryStats)) {
+                                 fn(sample);
+                             }
+                         },
+                         [&](uint64_t eqclass_id, uint64_t sample) {
+                             auto &samples = decodeColor(eqclass_id, lru_cache, rs, queryStats);
+                             return std::binary_search(samples.begin(), samples.end(), sample);
+                         });
+    return result;
+}
+
+template void MSTQuery::findSamples<CQF<KeyObject>>(CQF<KeyObject> &dbg, LRUCacheMap &lru_cache,
+                                                    RankScores *rs, QueryStats &queryStats);
+template void MSTQuery::findSamples<StaticKmerMap>(StaticKmerMap &dbg, LRUCacheMap &lru_cache,
+                                                   RankScores *rs, QueryStats &queryStats);
+template mantis::QueryResult &MSTQuery::findFilteredSamples<CQF<KeyObject>>(
+        CQF<KeyObject> &dbg, LRUCacheMap &lru_cache, RankScores *rs, QueryStats &queryStats,
+        const QueryFilter &filter);
+template mantis::QueryResult &MSTQuery::findFilteredSamples<StaticKmerMap>(
+        StaticKmerMap &dbg, LRUCacheMap &lru_cache, RankScores *rs, QueryStats &queryStats,
+        const QueryFilter &filter);
+
+
+void MSTQuery::parseKmers(const std::string &read) {
+    indexKmers.forEachKmer(read.data(), read.length(), [this](uint64_t, uint64_t item) {
+        kmer2cidMap[item] = std::numeric_limits<uint64_t>::max();
+    });
 }
 
-mantis::QueryResult MSTQuery::convertIndexK2QueryK(std::string &read) {
-    mantis::QueryResult res(numSamples, 0);
+mantis::QueryResult &MSTQuery::convertIndexK2QueryK(std::string &read, const QueryFilter &filter) {
+    result.clear();
     spp::sparse_hash_set<uint64_t> readkmers;
-    auto requiredCnt = static_cast<uint8_t>(queryK - indexK + 1);
     uint16_t queryIndxKDiff = static_cast<uint16_t>(queryK - indexK + 1);
-    bool done = false;
-    while (!done and read.length() >= queryK) {
-        uint64_t idx2replace = 0;
-        std::vector<uint8_t> samples(numSamples, 0);
-        std::vector<std::vector<bool>> pastKmers(queryIndxKDiff);
-        for (auto &v : pastKmers) {
-            v.resize(numSamples, false);
+    // The window holds the samples of each of the last queryIndxKDiff index k-mers, as a
+    // bitset and as the sample list of its color class (nullptr if the k-mer is not in the
+    // index). A sample has the query k-mer if it has all the index k-mers of the window.
+    std::vector<uint64_t> windowBits(queryIndxKDiff * numWrds, 0);
+    std::vector<const std::vector<uint64_t> *> windowSamples(queryIndxKDiff, nullptr);
+    auto colorSamples = [this](uint64_t item) -> const std::vector<uint64_t> * {
+        if (kmer2cidMap[item] == std::numeric_limits<uint64_t>::max()) {
+            return nullptr;
         }
-        uint64_t first = 0;
-        uint64_t first_rev = 0;
-        uint64_t item = 0;
-        bool allNuclValid = true;
-        for (uint32_t i = 0; i < indexK; i++) { //First kmer
-            uint8_t curr = Kmer::map_base(read[i]);
-            if (curr > DNA_MAP::G) { // 'N' is encountered
-                if (i + 1 < read.length())
-                    read = read.substr(i + 1);
-                else
-                    done = true; // you've reached the end of a sequence (last nucl. is N)
-                allNuclValid = false;
-                break;
+        return &cid2expMap[kmer2cidMap[item]];
+    };
+    // only the bits of the samples of the old and new color classes are touched
+    auto setSlot = [&](uint64_t slot, const std::vector<uint64_t> *samples) {
+        uint64_t *bits = windowBits.data() + slot * numWrds;
+        if (windowSamples[slot]) {
+            for (auto c : *windowSamples[slot]) {
+                bits[c >> 6] = 0;
             }
-            first = first | curr;
-            first = first << 2;
         }
-        if (allNuclValid) {
-            first = first >> 2;
-            first_rev = static_cast<uint64_t >(Kmer::reverse_complement(first, indexK));
-            item = Kmer::compare_kmers(first, first_rev) ? first : first_rev;
-            pastKmers[idx2replace].assign(pastKmers[idx2replace].size(), false);
-            if (kmer2cidMap[item] != std::numeric_limits<uint64_t>::max()) {
-                for (auto &c : cid2expMap[kmer2cidMap[item]]) {
-                    samples[c]++;
-                    pastKmers[idx2replace][c] = true;
-                }
+        if (samples) {
+            for (auto c : *samples) {
+                bits[c >> 6] |= 1ULL << (c & 63);
             }
-            uint64_t next = (first << 2) & BITMASK(2 * indexK);
-            uint64_t next_rev = first_rev >> 2;
-
-            for (uint64_t i = indexK; i < queryK; i++) { //next kmers
-                idx2replace = ++idx2replace % queryIndxKDiff;
-                uint8_t curr = Kmer::map_base(read[i]);
-                if (curr > DNA_MAP::G) { // 'N' is encountered
-                    if (i + 1 < read.length())
-                        read = read.substr(i + 1);
-                    else
-                        done = true;
-                    allNuclValid = false;
-                    break;
-                }
-                first = first << 2;
-                first |= curr;
-
-                next |= curr;
-                auto tmp = static_cast<uint64_t>(Kmer::reverse_complement_base(curr));
-                tmp <<= (indexK * 2 - 2);
-                next_rev = next_rev | tmp;
-                item = Kmer::compare_kmers(next, next_rev) ? next : next_rev;
-                if (kmer2cidMap[item] != std::numeric_limits<uint64_t>::max()) {
-                    for (auto &c : cid2expMap[kmer2cidMap[item]]) {
-                        samples[c]++;
-                        pastKmers[idx2replace][c] = true;
-                    }
-                }
-                next = (next << 2) & BITMASK(2 * indexK);
-                next_rev = next_rev >> 2;
+        }
+        windowSamples[slot] = samples;
+    };
+    // the candidates are the samples of the smallest color class of the window
+    auto countQueryKmer = [&]() {
+        uint64_t smallest = 0;
+        for (uint64_t slot = 0; slot < queryIndxKDiff; slot++) {
+            if (!windowSamples[slot]) {
+                return;
             }
-            if (allNuclValid) {
-                idx2replace = 0;
-                uint64_t i = 0;
-                uint64_t queryKmer = first, queryKmer_rev, queryItem; // to keep count of **unique** kmers
-                for (i = queryK; i < read.length(); i++) { //next kmers
-                    queryKmer_rev = static_cast<uint64_t >(Kmer::reverse_complement(queryKmer, queryK));
-                    queryItem = Kmer::compare_kmers(queryKmer, queryKmer_rev) ? queryKmer : queryKmer_rev;
-                    bool kmerNotFound = readkmers.find(queryItem) == readkmers.end();
-                    for (auto c = 0; c < samples.size(); c++) {
-                        if (kmerNotFound and samples[c] == requiredCnt) {
-                            res[c]++;
-                        }
-                        if (pastKmers[idx2replace][c]) {
-                            samples[c]--;
-                        }
-                        pastKmers[idx2replace][c] = false;
-                    }
-                    readkmers.insert(queryItem);
-                    uint8_t curr = Kmer::map_base(read[i]);
-                    if (curr > DNA_MAP::G) { // 'N' is encountered
-                        if (i + 1 < read.length())
-                            read = read.substr(i + 1);
-                        else
-                            done = true;
-                        break;
-                    }
-                    queryKmer <<= 2;
-                    queryKmer |= curr;
-                    queryKmer &= BITMASK(2 * queryK);
-
-                    next |= curr;
-                    auto tmp = static_cast<uint64_t>(Kmer::reverse_complement_base(curr));
-                    tmp <<= (indexK * 2 - 2);
-                    next_rev = next_rev | tmp;
-                    item = Kmer::compare_kmers(next, next_rev) ? next : next_rev;
-                    if (kmer2cidMap[item] != std::numeric_limits<uint64_t>::max()) {
-                        for (auto &c : cid2expMap[kmer2cidMap[item]]) {
-                            samples[c]++;
-                            pastKmers[idx2replace][c] = true;
-                        }
-                    }
-                    idx2replace = ++idx2replace % queryIndxKDiff;
-                    next = (next << 2) & BITMASK(2 * indexK);
-                    next_rev = next_rev >> 2;
-                }
-                if (i == read.length()) {
-                    queryKmer_rev = static_cast<uint64_t >(Kmer::reverse_complement(queryKmer, queryK));
-                    queryItem = Kmer::compare_kmers(queryKmer, queryKmer_rev) ? queryKmer : queryKmer_rev;
-                    bool kmerNotFound = readkmers.find(queryItem) == readkmers.end();
-                    for (auto c = 0; c < samples.size(); c++) {
-                        if (kmerNotFound and samples[c] == requiredCnt) {
-                            res[c]++;
-                        }
-                    }
-                    readkmers.insert(queryItem);
-                    done = true;
-                }
+            if (windowSamples[slot]->size() < windowSamples[smallest]->size()) {
+                smallest = slot;
             }
         }
-    }
+        for (auto c : *windowSamples[smallest]) {
+            bool inAll = true;
+            for (uint64_t slot = 0; slot < queryIndxKDiff and inAll; slot++) {
+                inAll = (windowBits[slot * numWrds + (c >> 6)] >> (c & 63)) & 1;
+            }
+            if (inAll) {
+                result.add(c, 1);
+            }
+        }
+    };
+    // a query k-mer ends where the last queryIndxKDiff index k-mers are consecutive
+    std::vector<uint64_t> queryItems;
+    queryKmers.extract(read.data(), read.length(), queryItems);
+    uint64_t nextQueryItem = 0, run = 0, lastEnd = 0;
+    indexKmers.forEachKmer(read.data(), read.length(), [&](uint64_t end, uint64_t item) {
+        run = (run and end == lastEnd + 1) ? run + 1 : 1;
+        lastEnd = end;
+        setSlot(end % queryIndxKDiff, colorSamples(item));
+        if (run >= queryIndxKDiff) {
+            uint64_t queryItem = queryItems[nextQueryItem++];
+            if (readkmers.find(queryItem) == readkmers.end()) {
+                countQueryKmer();
+                readkmers.insert(queryItem);
+            }
+        }
+    });
+    filter.apply(result, readkmers.size());
 //    std::cerr << "\n";
-    return res;
+    return result;
 }
 
 void MSTQuery::reset() {
@@ -362,98 +374,25 @@ void MSTQuery::reset() {
     cid2expMap.clear();
 }
 
-mantis::QueryResult MSTQuery::getResultList() {
-    mantis::QueryResult res(numSamples, 0);
+/**
+ * Counts the k-mers of each color class first, so that the samples of a color class are
+ * expanded once per read rather than once per k-mer.
+ */
+mantis::QueryResult &MSTQuery::getResultList() {
+    result.clear();
+    std::unordered_map<uint64_t, uint64_t> colorCounts;
+    colorCounts.reserve(cid2expMap.size());
     for (auto& kv : kmer2cidMap) {
         if (kv.second != std::numeric_limits<uint64_t>::max()) {
-            for (auto &c : cid2expMap[kv.second]) {
-                res[c]++;
-            }
-        }
-    }
-    return res;
-}
-
-void output_results(MSTQuery &mstQuery,
-                    std::ofstream &opfile,
-                    std::vector<std::string> &sampleNames,
-                    QueryStats &queryStats) {
-    //CLI::AutoTimer timer{"Second round going over the file + query time ", CLI::Timer::Big};
-    opfile << "seq" << queryStats.cnt++ << '\t' << mstQuery.getNumOfDistinctKmers() << '\n';
-    mantis::QueryResult result = mstQuery.getResultList();
-    for (uint64_t i = 0; i < result.size(); i++) {
-        if (result[i] > 0) {
-            opfile << sampleNames[i] << '\t' << result[i] << '\n';
-        }
-    }
-}
-
-void output_results_json(MSTQuery &mstQuery,
-                         std::ofstream &opfile,
-                         std::vector<std::string> &sampleNames,
-                         QueryStats &queryStats,
-                         uint64_t nquery) {
-    uint64_t qctr{0};
-    //CLI::AutoTimer timer{"Query time ", CLI::Timer::Big};
-    opfile << "{ \"qnum\": " << queryStats.cnt++ << ",  \"num_kmers\": "
-           << mstQuery.getNumOfDistinctKmers() << ", \"res\": {\n";
-    mantis::QueryResult result = mstQuery.getResultList();
-    uint64_t kmerCntr = 0;
-    for (auto it = result.begin(); it != result.end(); ++it) {
-        if (*it > 0)
-            opfile << " \"" << sampleNames[kmerCntr] << "\": " << *it;
-        if (std::next(it) != result.end()) {
-            opfile << ",\n";
-        }
-        kmerCntr++;
-    }
-    opfile << "}}";
-    if (qctr < nquery - 1) {
-        opfile << ",";
-    }
-    opfile << "\n";
-    ++qctr;
-}
-void output_results(std::string &read,
-                    MSTQuery &mstQuery,
-                    std::ofstream &opfile,
-                    std::vector<std::string> &sampleNames,
-                    QueryStats &queryStats) {
-    opfile << "seq" << queryStats.cnt++ << '\t' << read.length() << '\n';
-    mantis::QueryResult result = mstQuery.convertIndexK2QueryK(read);
-    for (uint64_t i = 0; i < result.size(); i++) {
-        if (result[i] > 0) {
-            opfile << sampleNames[i] << '\t' << result[i] << '\n';
+            colorCounts[kv.second]++;
         }
     }
-}
-
-void output_results_json(std::string &read,
-                         MSTQuery &mstQuery,
-                         std::ofstream &opfile,
-                         std::vector<std::string> &sampleNames,
-                         QueryStats &queryStats,
-                         uint64_t nquery) {
-    uint64_t qctr{0};
-    //CLI::AutoTimer timer{"Query time ", CLI::Timer::Big};
-    opfile << "{ \"qnum\": " << queryStats.cnt++ << ",  \"num_kmers\": "
-           << read.length() << ", \"res\": {\n";
-    mantis::QueryResult result = mstQuery.convertIndexK2QueryK(read);
-    uint64_t kmerCntr = 0;
-    for (auto it = result.begin(); it != result.end(); ++it) {
-        if (*it > 0)
-            opfile << " \"" << sampleNames[kmerCntr] << "\": " << *it;
-        if (std::next(it) != result.end()) {
-            opfile << ",\n";
+    for (auto& kv : colorCounts) {
+        for (auto sample : cid2expMap[kv.first]) {
+            result.add(sample, kv.second);
         }
-        kmerCntr++;
     }
-    opfile << "}}";
-    if (qctr < nquery - 1) {
-        opfile << ",";
-    }
-    opfile << "\n";
-    ++qctr;
+    return result;
 }
 
 std::vector<std::string> loadSampleFile(const std::string &sampleFileAddr) {
@@ -481,6 +420,13 @@ int mst_query_main(QueryOpts &opt) {
     QueryStats queryStats;
 
     spdlog::logger *logger = opt.console.get();
+    if (opt.theta < 0 or opt.theta > 1) {
+        logger->error("--theta must be between 0 and 1.");
+        std::exit(1);
+    }
+    if (opt.huge_pages) {
+        qf_set_hugepages(true);
+    }
     std::string dbg_file(opt.prefix + mantis::CQF_FILE);
     std::string sample_file(opt.prefix + mantis::SAMPLEID_FILE);
 
@@ -488,73 +434,104 @@ int mst_query_main(QueryOpts &opt) {
     queryStats.numSamples = sampleNames.size();
     logger->info("Number of experiments: {}", queryStats.numSamples);
 
-    logger->info("Loading cqf...");
-    CQF<KeyObject> cqf(dbg_file, CQF_FREAD);
-    auto indexK = cqf.keybits() / 2;
+    // the index is read by threads on any node, so its pages are spread over
+    // all of them instead of all landing on the node of the loading thread
+    if (opt.numa_interleave) {
+        if (set_numa_interleave(true)) {
+            logger->info("Interleaving the index over {} NUMA nodes", numa_nodes().size());
+        } else {
+            logger->warn("The kernel has no NUMA support, the index is not interleaved");
+        }
+    }
+
+    // an index built with --static-map has a static k-mer map instead of the CQF
+    std::unique_ptr<CQF<KeyObject>> cqf;
+    StaticKmerMap kmerMap;
+    uint32_t indexK;
+    if (mantis::fs::FileExists(dbg_file.c_str())) {
+        logger->info("Loading cqf...");
+        cqf.reset(new CQF<KeyObject>(dbg_file, CQF_FREAD));
+        indexK = cqf->keybits() / 2;
+        logger->info("Done loading cqf. k is {}", indexK);
+        if (opt.huge_pages) {
+            logger->info("CQF pages: {}", cqf_page_info(cqf->get_cqf()));
+        }
+    } else {
+        logger->info("Loading static k-mer map...");
+        if (!kmerMap.load(opt.prefix + mantis::STATIC_MAP_FILE)) {
+            logger->error("Could not load the CQF or the static k-mer map from {}", opt.prefix);
+            std::exit(1);
+        }
+        indexK = kmerMap.keybits() / 2;
+        logger->info("Done loading static k-mer map. k is {}", indexK);
+        if (opt.huge_pages) {
+            kmerMap.useHugePages(logger);
+        }
+    }
     if (queryK == 0) queryK = indexK;
-    logger->info("Done loading cqf. k is {}", indexK);
 
     logger->info("Loading color classes...");
     MSTQuery mstQuery(opt.prefix, indexK, queryK, queryStats.numSamples, logger);
     logger->info("Done Loading color classes. Total # of color classes is {}",
                  mstQuery.parentbv.size() - 1);
+    if (opt.huge_pages) {
+        mstQuery.useHugePages();
+    }
+    if (opt.numa_interleave) {
+        set_numa_interleave(false);
+    }
 
     logger->info("Querying colored dbg.");
-    std::ofstream opfile(opt.output);
+    std::unique_ptr<QueryWriter> writer = makeQueryWriter(opt, sampleNames, "seq");
+    QueryFilter filter{opt.theta, opt.top};
     LRUCacheMap cache_lru(100000);
     RankScores rs(1);
     std::ifstream ipfile(opt.query_file);
     std::string read;
     uint64_t numOfQueries{0};
+    auto findSamples = [&]() {
+        if (cqf) {
+            mstQuery.findSamples(*cqf, cache_lru, &rs, queryStats);
+        } else {
+            mstQuery.findSamples(kmerMap, cache_lru, &rs, queryStats);
+        }
+    };
     CLI::AutoTimer timer{"query time ", CLI::Timer::Big};
     if (opt.process_in_bulk) {
         while (ipfile >> read) {
-            mstQuery.parseKmers(read, indexK);
+            mstQuery.parseKmers(read);
             numOfQueries++;
         }
-        mstQuery.findSamples(cqf, cache_lru, &rs, queryStats);
+        findSamples();
         ipfile.clear();
         ipfile.seekg(0, ios::beg);
-        if (opt.use_json) {
-            opfile << "[\n";
-            while (ipfile >> read) {
-                output_results_json(read, mstQuery, opfile, sampleNames, queryStats, numOfQueries);
-            }
-            opfile << "]\n";
-        } else {
-            while (ipfile >> read) {
-                output_results(read, mstQuery, opfile, sampleNames, queryStats);
-            }
+        while (ipfile >> read) {
+            writer->write(read.length(), mstQuery.convertIndexK2QueryK(read, filter));
         }
     } else {
-        if (opt.use_json) {
-            opfile << "[\n";
-            while (ipfile >> read) {
-                mstQuery.reset();
-                mstQuery.parseKmers(read, indexK);
-                mstQuery.findSamples(cqf, cache_lru, &rs, queryStats);
-                if (mstQuery.indexK == mstQuery.queryK)
-                    output_results_json(mstQuery, opfile, sampleNames, queryStats, numOfQueries);
-                else
-                    output_results_json(read, mstQuery, opfile, sampleNames, queryStats, numOfQueries);
-                numOfQueries++;
-            }
-            opfile << "]\n";
-        } else {
-            while (ipfile >> read) {
-                mstQuery.reset();
-                mstQuery.parseKmers(read, indexK);
-                mstQuery.findSamples(cqf, cache_lru, &rs, queryStats);
+        while (ipfile >> read) {
+            mstQuery.reset();
+            mstQuery.parseKmers(read);
+            if (mstQuery.indexK == mstQuery.queryK and filter.enabled()) {
+                mantis::QueryResult &result = cqf ?
+                        mstQuery.findFilteredSamples(*cqf, cache_lru, &rs, queryStats, filter) :
+                        mstQuery.findFilteredSamples(kmerMap, cache_lru, &rs, queryStats, filter);
+                writer->write(mstQuery.getNumOfDistinctKmers(), result);
+            } else {
+                findSamples();
                 if (mstQuery.indexK == mstQuery.queryK)
-                    output_results(mstQuery, opfile, sampleNames, queryStats);
+                    writer->write(mstQuery.getNumOfDistinctKmers(), mstQuery.getResultList());
                 else
-                    output_results(read, mstQuery, opfile, sampleNames, queryStats);
-                numOfQueries++;
+                    writer->write(read.length(), mstQuery.convertIndexK2QueryK(read, filter));
             }
+            numOfQueries++;
         }
     }
-    opfile.close();
+    writer->close();
     logger->info("Writing done.");
+    if (opt.numa_interleave) {
+        logger->info("Memory per NUMA node: {}", numa_placement_info());
+    }
 
     logger->info("cache was used {} times and not used {} times",
                  queryStats.cacheCntr, queryStats.noCacheCntr);
@@ -41,111 +41,42 @@
 #include "kmer.h"
 #include "coloreddbg.h"
 #include "common_types.h"
+#include "queryWriter.h"
 #include "CLI/CLI.hpp"
 #include "CLI/Timer.hpp"
 #include "mantisconfig.hpp"
 
 void output_results(mantis::QuerySets& multi_kmers,
 										ColoredDbg<SampleObject<CQF<KeyObject>*>, KeyObject>&
-										cdbg, std::ofstream& opfile, bool is_bulk,
+										cdbg, QueryWriter& writer, bool is_bulk,
+										const QueryFilter& filter,
                     std::unordered_map<mantis::KmerHash, uint64_t> &uniqueKmers) {
-  mantis::QueryResults qres;
-	uint32_t cnt= 0;
+	// reused by all the queries
+	mantis::QueryResult kmerCnt(cdbg.get_num_samples());
   {
     CLI::AutoTimer timer{"Query time ", CLI::Timer::Big};
     if (is_bulk) {
         std::unordered_map<uint64_t, std::vector<uint64_t>> result = cdbg.find_samples(uniqueKmers);
         for (auto& kmers : multi_kmers) {
-            opfile <<  cnt++ << '\t' << kmers.size() << '\n';
-            std::vector<uint64_t> kmerCnt(cdbg.get_num_samples());
+            kmerCnt.clear();
             for (auto &k : kmers) {
                 if (uniqueKmers[k]) {
                     for (auto experimentId : result[k]) {
-                        kmerCnt[experimentId]++;
+                        kmerCnt.add(experimentId, 1);
                     }
                 }
             }
-            for (auto i=0; i<kmerCnt.size(); ++i) {
-                if (kmerCnt[i] > 0)
-                    opfile << cdbg.get_sample(i) << '\t' << kmerCnt[i] << '\n';
-            }
-            //++qctr;
+            filter.apply(kmerCnt, kmers.size());
+            writer.write(kmers.size(), kmerCnt);
         }
     } else {
         for (auto &kmers : multi_kmers) {
             //std::sort(kmers.begin(), kmers.end());
-            opfile << cnt++ << '\t' << kmers.size() << '\n';
-            mantis::QueryResult result = cdbg.find_samples(kmers);
-            for (auto i = 0; i < result.size(); ++i) {
-                if (result[i] > 0)
-                    opfile << cdbg.get_sample(i) << '\t' << result[i] << '\n';
-            }
-            //++qctr;
+            cdbg.find_samples(kmers, kmerCnt, filter);
+            writer.write(kmers.size(), kmerCnt);
         }
     }
-  }
-}
-
-void output_results_json(mantis::QuerySets& multi_kmers,
-												 ColoredDbg<SampleObject<CQF<KeyObject>*>, KeyObject>&
-												 cdbg, std::ofstream& opfile, bool is_bulk,
-                         std::unordered_map<mantis::KmerHash, uint64_t> &uniqueKmers) {
-  mantis::QueryResults qres;
-	uint32_t cnt= 0;
-  {
-    CLI::AutoTimer timer{"Query time ", CLI::Timer::Big};
-
-    opfile << "[\n";
-      size_t qctr{0};
-      size_t nquery{multi_kmers.size()};
-
-      if (is_bulk) {
-          std::unordered_map<uint64_t, std::vector<uint64_t>> result = cdbg.find_samples(uniqueKmers);
-          for (auto& kmers : multi_kmers) {
-              opfile << "{ \"qnum\": " << cnt++ << ",  \"num_kmers\": " << kmers.size() << ", \"res\": {\n";
-              std::vector<uint64_t> kmerCnt(cdbg.get_num_samples());
-              for (auto &k : kmers) {
-                  if (uniqueKmers[k]) {
-                      for (auto experimentId : result[k]) {
-                          kmerCnt[experimentId]++;
-                      }
-                  }
-              }
-              for (auto i=0; i<kmerCnt.size(); ++i) {
-                  if (kmerCnt[i] > 0) {
-                          opfile << " \"" << cdbg.get_sample(i) << "\": " << kmerCnt[i];
-                      if (i != kmerCnt.size()) {
-                          opfile << ",\n";
-                      }
-                  }
-              }
-              opfile << "}}";
-              if (qctr < nquery - 1) { opfile << ","; }
-              opfile << "\n";
-              ++qctr;
-          }
-      }
-      else {
-          for (auto &kmers : multi_kmers) {
-              //std::sort(kmers.begin(), kmers.end());
-              opfile << "{ \"qnum\": " << cnt++ << ",  \"num_kmers\": " << kmers.size() << ", \"res\": {\n";
-              mantis::QueryResult result = cdbg.find_samples(kmers);
-              uint64_t sampleCntr = 0;
-              for (auto it = result.begin(); it != result.end(); ++it) {
-                  if (*it > 0)
-                      opfile << " \"" << cdbg.get_sample(sampleCntr) << "\": " << *it;
-                  if (std::next(it) != result.end()) {
-                      opfile << ",\n";
-                  }
-                  sampleCntr++;
-              }
-              opfile << "}}";
-              if (qctr < nquery - 1) { opfile << ","; }
-              opfile << "\n";
-              ++qctr;
-          }
-      }
-    opfile << "]\n";
+    writer.close();
   }
 }
 
@@ -162,8 +93,6 @@ int query_main (QueryOpts& opt)
 
   std::string prefix = opt.prefix;
   std::string query_file = opt.query_file;
-  std::string output_file = opt.output;//{"samples.output"};
-  bool use_json = opt.use_json;
 
   // Make sure the prefix is a full folder
   if (prefix.back() != '/') {
@@ -175,20 +104,47 @@ int query_main (QueryOpts& opt)
   }
 
   spdlog::logger* console = opt.console.get();
+	if (opt.theta < 0 || opt.theta > 1) {
+		console->error("--theta must be between 0 and 1.");
+		exit(1);
+	}
 	console->info("Reading colored dbg from disk.");
 
+	if (opt.huge_pages)
+		qf_set_hugepages(true);
+	if (opt.numa_interleave) {
+		if (set_numa_interleave(true))
+			console->info("Interleaving the index over {} NUMA nodes",
+										numa_nodes().size());
+		else
+			console->warn("The kernel has no NUMA support, the index is not interleaved");
+	}
 	std::string dbg_file(prefix + mantis::CQF_FILE);
+	int dbg_flag = MANTIS_DBG_IN_MEMORY;
+	// index built with --static-map
+	if (!mantis::fs::FileExists(dbg_file.c_str())) {
+		dbg_file = prefix + mantis::STATIC_MAP_FILE;
+		dbg_flag = MANTIS_DBG_STATIC_MAP;
+	}
 	std::string sample_file(prefix + mantis::SAMPLEID_FILE);
 	std::vector<std::string> eqclass_files = mantis::fs::GetFilesExt(prefix.c_str(),
                                                                    mantis::EQCLASS_FILE);
+	// index built with --color-matrix
+	if (eqclass_files.empty())
+		eqclass_files = mantis::fs::GetFilesExt(prefix.c_str(),
+																						mantis::COLOR_MATRIX_FILE);
 
 	ColoredDbg<SampleObject<CQF<KeyObject>*>, KeyObject> cdbg(dbg_file,
 																														eqclass_files,
 																														sample_file,
-																														MANTIS_DBG_IN_MEMORY);
-	uint64_t kmer_size = cdbg.get_cqf()->keybits() / 2;
+																														dbg_flag);
+	uint64_t kmer_size = cdbg.get_key_bits() / 2;
   console->info("Read colored dbg with {} k-mers and {} color classes",
-                cdbg.get_cqf()->dist_elts(), cdbg.get_num_bitvectors());
+                cdbg.get_num_kmers(), cdbg.get_num_bitvectors());
+	if (opt.huge_pages && dbg_flag == MANTIS_DBG_IN_MEMORY)
+		console->info("CQF pages: {}", cqf_page_info(cdbg.get_cqf()->get_cqf()));
+	if (opt.numa_interleave)
+		set_numa_interleave(false);
 
 	//cdbg.get_cqf()->dump_metadata(); 
 	//CQF<KeyObject> cqf(query_file, false);
@@ -214,17 +170,17 @@ int query_main (QueryOpts& opt)
 																										uniqueKmers);
 	console->info("Total k-mers to query: {}", total_kmers);
 
-	std::ofstream opfile(output_file);
+	std::vector<std::string> sampleNames;
+	for (uint64_t i = 0; i < cdbg.get_num_samples(); i++)
+		sampleNames.push_back(cdbg.get_sample(i));
+	std::unique_ptr<QueryWriter> writer = makeQueryWriter(opt, sampleNames, "");
 	console->info("Querying the colored dbg.");
 
-  if (use_json) {
-    output_results_json(multi_kmers, cdbg, opfile, opt.process_in_bulk, uniqueKmers);
-  } else {
-    output_results(multi_kmers, cdbg, opfile, opt.process_in_bulk, uniqueKmers);
-  }
-	//std::cout << "Writing samples and abundances out." << std::endl;
-	opfile.close();
+	output_results(multi_kmers, cdbg, *writer, opt.process_in_bulk,
+								 QueryFilter{opt.theta, opt.top}, uniqueKmers);
 	console->info("Writing done.");
+	if (opt.numa_interleave)
+		console->info("Memory per NUMA node: {}", numa_placement_info());
 
 	return EXIT_SUCCESS;
 }				/* ----------  end of function main  ---------- */
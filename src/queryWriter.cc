@@ -0,0 +1,276 @@
+#include <charconv>
+#include <iostream>
+
+#include "queryWriter.h"
+
+namespace {
+class TsvQueryFormat : public QueryFormat {
+public:
+    TsvQueryFormat(const std::vector<std::string> &sampleNames, const std::string &queryLabel) :
+            queryLabel(queryLabel) {
+        for (auto &name : sampleNames) {
+            prefixes.push_back(name + '\t');
+        }
+    }
+
+private:
+    void format(const QueryBatch &batch, QueryOutput &out) override {
+        uint64_t hit = 0;
+        for (uint64_t q = 0; q < batch.queries.size(); ++q) {
+            out.put(queryLabel);
+            out.putNumber(batch.firstQuery + q);
+            out.put('\t');
+            out.putNumber(batch.queries[q].first);
+            out.put('\n');
+            for (; hit < batch.queries[q].second; ++hit) {
+                out.put(prefixes[batch.hits[hit].first]);
+                out.putNumber(batch.hits[hit].second);
+                out.put('\n');
+            }
+        }
+    }
+
+    std::string queryLabel;
+    // "<sample name>\t"
+    std::vector<std::string> prefixes;
+};
+
+/**
+ * One array of query objects, written as the queries come, so the separators
+ * go before every query and every hit but the first.
+ */
+class JsonQueryFormat : public QueryFormat {
+public:
+    explicit JsonQueryFormat(const std::vector<std::string> &sampleNames) {
+        for (auto &name : sampleNames) {
+            std::string prefix = " \"";
+            for (char c : name) {
+                if (c == '"' or c == '\\') {
+                    prefix += '\\';
+                }
+                prefix += c;
+            }
+            prefixes.push_back(prefix + "\": ");
+        }
+    }
+
+private:
+    void begin(QueryOutput &out) override { out.put("[\n"); }
+
+    void format(const QueryBatch &batch, QueryOutput &out) override {
+        uint64_t hit = 0;
+        for (uint64_t q = 0; q < batch.queries.size(); ++q) {
+            if (batch.firstQuery + q > 0) {
+                out.put(",\n");
+            }
+            out.put("{ \"qnum\": ");
+            out.putNumber(batch.firstQuery + q);
+            out.put(",  \"num_kmers\": ");
+            out.putNumber(batch.queries[q].first);
+            out.put(", \"res\": {\n");
+            uint64_t first = hit;
+            for (; hit < batch.queries[q].second; ++hit) {
+                if (hit > first) {
+                    out.put(",\n");
+                }
+                out.put(prefixes[batch.hits[hit].first]);
+                out.putNumber(batch.hits[hit].second);
+            }
+            out.put("}}");
+            ++numWritten;
+        }
+    }
+
+    void end(QueryOutput &out) override {
+        if (numWritten) {
+            out.put('\n');
+        }
+        out.put("]\n");
+    }
+
+    uint64_t numWritten{0};
+    // " \"<sample name>\": "
+    std::vector<std::string> prefixes;
+};
+
+/**
+ * Sparse matrix of the counts of the samples in the queries, by query:
+ * the header, then for each query its k-mers and hits as two uint64_t, followed
+ * by (sample id, count) as two uint32_t for each of its hits, by sample id.
+ * The numbers of queries and hits of the header are left as
+ * QUERY_RESULT_UNKNOWN_COUNT when the output can't be rewound (a pipe, or gzip).
+ */
+class BinaryQueryFormat : public QueryFormat {
+public:
+    explicit BinaryQueryFormat(uint64_t numSamples) {
+        header.numSamples = numSamples;
+    }
+
+private:
+    struct Header {
+        uint64_t magic{mantis::QUERY_RESULT_MAGIC};
+        uint32_t version{mantis::QUERY_RESULT_VERSION};
+        uint32_t reserved{0};
+        uint64_t numSamples{0};
+        uint64_t numQueries{mantis::QUERY_RESULT_UNKNOWN_COUNT};
+        uint64_t numHits{mantis::QUERY_RESULT_UNKNOWN_COUNT};
+    };
+
+    // the counts are unknown until end, which fills them in if it can
+    void begin(QueryOutput &out) override { out.putBinary(header); }
+
+    void format(const QueryBatch &batch, QueryOutput &out) override {
+        uint64_t hit = 0;
+        for (auto &query : batch.queries) {
+            out.putBinary(query.first);
+            out.putBinary(query.second - hit);
+            for (; hit < query.second; ++hit) {
+                out.putBinary(static_cast<uint32_t>(batch.hits[hit].first));
+                out.putBinary(static_cast<uint32_t>(batch.hits[hit].second));
+            }
+        }
+        numQueries += batch.queries.size();
+        numHits += batch.hits.size();
+    }
+
+    void end(QueryOutput &out) override {
+        if (out.rewind()) {
+            header.numQueries = numQueries;
+            header.numHits = numHits;
+            out.putBinary(header);
+        }
+    }
+
+    Header header;
+    uint64_t numQueries{0};
+    uint64_t numHits{0};
+};
+}
+
+void QueryOutput::putNumber(uint64_t v) {
+    char buf[20];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, res.ptr - buf);
+}
+
+void QueryOutput::flush() {
+    if (out.empty()) {
+        return;
+    }
+    bool written = gz ? gzwrite(gz, out.data(), out.size()) == static_cast<int>(out.size())
+                      : std::fwrite(out.data(), 1, out.size(), file) == out.size();
+    if (!written) {
+        std::cerr << "Could not write the query results.\n";
+        std::exit(1);
+    }
+    out.clear();
+}
+
+bool QueryOutput::rewind() {
+    flush();
+    return !gz and std::fseek(file, 0, SEEK_SET) == 0;
+}
+
+void QueryOutput::close() {
+    flush();
+    if ((gz ? gzclose(gz) != Z_OK : std::fclose(file) != 0)) {
+        std::cerr << "Could not write the query results.\n";
+        std::exit(1);
+    }
+}
+
+QueryWriter::QueryWriter(std::unique_ptr<QueryFormat> format, FILE *file, gzFile gz) :
+        queryFormat(std::move(format)), out(file, gz) {
+    formatter = std::thread(&QueryWriter::run, this);
+}
+
+QueryWriter::~QueryWriter() {
+    close();
+}
+
+void QueryWriter::write(uint64_t numKmers, mantis::QueryResult &result) {
+    result.for_each_hit([this](uint64_t sample, uint64_t count) {
+        filling.hits.emplace_back(sample, count);
+    });
+    filling.queries.emplace_back(numKmers, filling.hits.size());
+    if (filling.queries.size() + filling.hits.size() >= mantis::QUERY_WRITER_BATCH) {
+        submit();
+    }
+}
+
+void QueryWriter::close() {
+    if (closed) {
+        return;
+    }
+    if (!filling.queries.empty()) {
+        submit();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    cv.notify_all();
+    formatter.join();
+    out.close();
+    closed = true;
+}
+
+void QueryWriter::submit() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return !fullReady; });
+    std::swap(full, filling);
+    full.firstQuery = numQueries;
+    numQueries += full.queries.size();
+    fullReady = true;
+    lock.unlock();
+    cv.notify_all();
+    filling.clear();
+}
+
+void QueryWriter::run() {
+    queryFormat->begin(out);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return fullReady or closing; });
+            if (!fullReady) {
+                break;
+            }
+            std::swap(formatting, full);
+            fullReady = false;
+        }
+        cv.notify_all();
+        queryFormat->format(formatting, out);
+        formatting.clear();
+        if (out.size() >= mantis::QUERY_WRITER_BUFFER) {
+            out.flush();
+        }
+    }
+    queryFormat->end(out);
+    out.flush();
+}
+
+std::unique_ptr<QueryWriter> makeQueryWriter(const QueryOpts &opt,
+                                             const std::vector<std::string> &sampleNames,
+                                             const std::string &queryLabel) {
+    FILE *file = nullptr;
+    gzFile gz = nullptr;
+    if (opt.gzip) {
+        gz = gzopen(opt.output.c_str(), mantis::QUERY_GZIP_MODE);
+    } else {
+        file = std::fopen(opt.output.c_str(), "wb");
+    }
+    if (file == nullptr and gz == nullptr) {
+        std::cerr << "Could not open " << opt.output << " for writing.\n";
+        std::exit(1);
+    }
+    std::unique_ptr<QueryFormat> format;
+    if (opt.use_binary) {
+        format.reset(new BinaryQueryFormat(sampleNames.size()));
+    } else if (opt.use_json) {
+        format.reset(new JsonQueryFormat(sampleNames));
+    } else {
+        format.reset(new TsvQueryFormat(sampleNames, queryLabel));
+    }
+    return std::unique_ptr<QueryWriter>(new QueryWriter(std::move(format), file, gz));
+}
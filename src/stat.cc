@@ -7,6 +7,7 @@
 #include "stat.h"
 #include "ProgOpts.h"
 #include "canonicalKmer.h"
+#include "dbgColorIds.h"
 
 void Stat::operator++(void) {
 
@@ -18,7 +19,7 @@ void Stat::operator++(void) {
         std::cerr << "\rvisited " << kmerCntr << " kmers";
     while (!it.done()) {
         KeyObject key((*it).key, 0, 0);
-        uint64_t eqidx = cqf.get_unique_index(key, 0);
+        uint64_t eqidx = dbg_unique_index(cqf, key, 0);
         if (visited[eqidx]) {
             //if (visitedKeys.find(it.get_cur_hash().key) != visitedKeys.end()) {
             //if ((bool)(visited[it.iter.current])) {
@@ -36,6 +37,11 @@ void Stat::operator++(void) {
 
 
 Mc_stats Stat::operator*(void) {
+    return dna::with_kmer_length(k, [this](auto K) { return monochromeComponent<decltype(K)::value>(); });
+}
+
+template <uint32_t K>
+Mc_stats Stat::monochromeComponent() {
     if (!work.empty()) {
         std::cerr << "Throw Exception. The work queue should be empty at this point.\n";
         std::exit(1);
@@ -45,74 +51,32 @@ Mc_stats Stat::operator*(void) {
 
     dna::canonical_kmer root(static_cast<int>(k), (*it).key);
     KeyObject key((*it).key, 0, 0);
-    uint64_t eqidx = cqf.get_unique_index(key, 0);
-    workItem cur = {root, static_cast<colorIdType>((*it).count - 1), cqf.keybits(), eqidx};
+    uint64_t eqidx = dbg_unique_index(cqf, key, 0);
+    workItem cur = {root, static_cast<colorIdType>(dbg_eqclass(cqf, *it) - 1), cqf.keybits(), eqidx};
     work.push(cur);
     res.color = cur.colorId;
     while (!work.empty()) {
         workItem w = work.front();
         work.pop();
-//        std::cerr << "v" << w.uniqueIdx << "\n";
         if (visited[w.uniqueIdx]) continue;
         visited[w.uniqueIdx] = 1;
-        //if (visitedKeys.find(w.kmerHash) != visitedKeys.end()) continue;
-        //visitedKeys.insert(w.kmerHash);
 
-        for (auto &neighbor : neighbors(w)) {
-            /* std::cerr << "n" << std::string(neighbor.node) << " " << neighbor.kmerHash
-             << " " << neighbor.colorId << " "
-             << neighbor.uniqueIdx << "\n";*/
-            //std::cerr << "nei";
-            if (visited[neighbor.uniqueIdx] == 0) {
-                //if (visitedKeys.find(neighbor.kmerHash) == visitedKeys.end()) {
-                /*std::cerr << globalFuckingCounter << "not visited\n";
-                if (globalFuckingCounter > 50)
-                    std::exit(1);
-                globalFuckingCounter++;*/
-                if (neighbor.colorId == w.colorId) {
-                    //std::cerr << "pushed ";
-                    work.push(neighbor);
-                    res.nodeCnt++;
-                    //visitedKeys.insert(neighbor.kmerHash);
-                }
+        dna::fixed_kmer<K>::for_each_neighbor(w.node.val, [&](uint64_t nei) {
+            uint64_t eqid = 0, neiIdx = 0;
+            if (exists(nei, eqid, neiIdx) and visited[neiIdx] == 0 and eqid == w.colorId) {
+                work.push(workItem(dna::canonical_kmer(K, nei), eqid, cqf.keybits(), neiIdx));
+                res.nodeCnt++;
             }
-            //std::cerr << "\n";
-        }
+        });
     }
     return res;
 }
 
-
-std::set<workItem> Stat::neighbors(workItem n) {
-    std::set<workItem> result;
-    for (const auto b : dna::bases) {
-        uint64_t eqid = 0, eqidx = 0;
-        if (exists(n.node << b, eqid, eqidx)) {
-            auto wi = workItem(n.node << b, eqid, cqf.keybits(), eqidx);
-            //std::cerr<< "i" << wi.kmerHash << "\n";
-            result.insert(wi);
-        }
-        if (exists(b >> n.node, eqid, eqidx)) {
-
-            auto wi = workItem(b >> n.node, eqid, cqf.keybits(), eqidx);
-            //std::cerr<< "i" << wi.kmerHash << "\n";
-            result.insert(wi);
-        }
-    }
-/*
-    std::cerr << "nighbors:\n";
-    for (auto res: result) {
-        std::cerr << res.kmerHash << "\n";
-    }
-*/
-    return result;
-}
-
-bool Stat::exists(dna::canonical_kmer e, uint64_t &eqid, uint64_t &eqidx) {
-    KeyObject key(e.val, 0, 0);
+bool Stat::exists(uint64_t kmer, uint64_t &eqid, uint64_t &eqidx) {
+    KeyObject key(kmer, 0, 0);
     //std::cerr << "e:" << std::string(e) << " ";
-    auto eqidtmp = cqf.query(key, 0);
-    auto idx = cqf.get_unique_index(key, 0);
+    auto eqidtmp = dbg_eqclass(cqf, key, 0);
+    auto idx = dbg_unique_index(cqf, key, 0);
 
     //std::cerr << "c" << eqidtmp;
     if (eqidtmp) {
@@ -128,7 +92,7 @@ bool Stat::exists(dna::canonical_kmer e, uint64_t &eqid, uint64_t &eqidx) {
 bool Stat::done() { return it.done(); }
 
 std::vector<uint64_t> Stat::queryColor() {
-    colorIdType idx = static_cast<colorIdType>((*it).count - 1);
+    colorIdType idx = static_cast<colorIdType>(dbg_eqclass(cqf, *it) - 1);
     std::vector<uint64_t> setbits;
     RankScores rs(1);
     nonstd::optional<uint64_t> dummy{nonstd::nullopt};
@@ -151,7 +115,7 @@ std::vector<uint64_t> Stat::queryColor() {
 }
 
 uint64_t Stat::getKey() { return (*it).key; }
-uint64_t Stat::getColor() { return (*it).count - 1;}
+uint64_t Stat::getColor() { return dbg_eqclass(cqf, *it) - 1;}
 
 void Stat::increaseCounter(uint64_t idx, uint64_t cnt) {
     uint64_t prefix = (idx * (idx + 1)) / 2 - 1;
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <fstream>
+
+#include "gqf/gqf_int.h"
+#include "gqf/hashutil.h"
+#include "staticKmerMap.h"
+
+namespace {
+// finalizer of MurmurHash3, derives independent hashes from the k-mer hash
+inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+inline uint64_t levelSeed(uint32_t level) {
+    return (level + 1) * 0x9e3779b97f4a7c15ULL;
+}
+
+// calls fn(hash, count) for every k-mer of the CQF in hash order
+template <class F>
+void forEachKmer(const QF *qf, F fn) {
+    QFi qfi;
+    if (qf_iterator_from_position(qf, &qfi, 0) == QFI_INVALID) {
+        return;
+    }
+    do {
+        uint64_t hash, value, count;
+        qfi_get_hash(&qfi, &hash, &value, &count);
+        fn(hash, count);
+    } while (qfi_next(&qfi) != QFI_INVALID);
+}
+}
+
+/**
+ * hashes a k-mer the same way the CQF it was built from does
+ * @param key the k-mer
+ * @return the hash the CQF stores for the k-mer
+ */
+uint64_t StaticKmerMap::hashKey(uint64_t key) const {
+    if (hashMode == QF_HASH_DEFAULT) {
+        return MurmurHash64A(&key, sizeof(key), seed) % range;
+    } else if (hashMode == QF_HASH_INVERTIBLE) {
+        return hash_64(key, keyBits == 64 ? ~0ULL : (1ULL << keyBits) - 1);
+    }
+    return key;
+}
+
+/**
+ * @param hash k-mer hash
+ * @param level level of the cascade
+ * @return the position of the k-mer in the given level (offset by the previous levels)
+ */
+uint64_t StaticKmerMap::levelPos(uint64_t hash, uint32_t level) const {
+    uint64_t levelSize = levelOffsets[level + 1] - levelOffsets[level];
+    return levelOffsets[level] +
+           static_cast<uint64_t>((static_cast<__uint128_t>(mix64(hash ^ levelSeed(level))) * levelSize) >> 64);
+}
+
+/**
+ * @param hash k-mer hash
+ * @return the slot of the k-mer, or numKmers if it didn't land in any level or the fallback
+ * (a k-mer that is not in the map can still land in a slot, its hash tells them apart)
+ */
+uint64_t StaticKmerMap::lookup(uint64_t hash) const {
+    for (uint32_t level = 0; level + 1 < levelOffsets.size(); level++) {
+        uint64_t pos = levelPos(hash, level);
+        if (levels[pos]) {
+            return levelsRank(pos);
+        }
+    }
+    auto it = std::lower_bound(fallback.begin(), fallback.end(), hash);
+    if (it != fallback.end() && *it == hash) {
+        return numPlaced + static_cast<uint64_t>(it - fallback.begin());
+    }
+    return numKmers;
+}
+
+/**
+ * keeps the positions of the level that were hit by exactly one k-mer
+ * @param seen positions hit by at least one k-mer, becomes the level
+ * @param collided positions hit by more than one k-mer
+ * @param levelBits levels built so far
+ */
+void StaticKmerMap::addLevel(sdsl::bit_vector &seen, const sdsl::bit_vector &collided,
+                             std::vector<sdsl::bit_vector> &levelBits) {
+    uint64_t *words = seen.data();
+    const uint64_t *collidedWords = collided.data();
+    for (uint64_t i = 0; i < seen.size() / 64; i++) {
+        words[i] &= ~collidedWords[i];
+    }
+    levelBits.push_back(std::move(seen));
+}
+
+/**
+ * builds the cascade of levels over the k-mer hashes, then stores the hash
+ * and color class id of each k-mer in its slot
+ * The CQF is streamed for the first level, only the k-mers that collide in it are kept in memory
+ * @param cqf the dbg CQF
+ */
+void StaticKmerMap::build(const CQF<KeyObject> &cqf, spdlog::logger *logger) {
+    const QF *qf = cqf.get_cqf();
+    keyBits = cqf.keybits();
+    hashMode = cqf.hash_mode();
+    seed = cqf.seed();
+    range = cqf.range();
+    numKmers = cqf.dist_elts();
+
+    levelOffsets.assign(1, 0);
+    std::vector<sdsl::bit_vector> levelBits;
+    std::vector<uint64_t> remaining;
+    uint64_t maxColorId{0};
+    for (uint32_t level = 0; level < maxLevels; level++) {
+        uint64_t numLeft = level == 0 ? numKmers : remaining.size();
+        if (numLeft == 0) {
+            break;
+        }
+        uint64_t levelSize = ((static_cast<uint64_t>(gamma * numLeft) + 63) / 64) * 64;
+        levelOffsets.push_back(levelOffsets.back() + levelSize);
+        sdsl::bit_vector seen(levelSize, 0), collided(levelSize, 0);
+        auto mark = [&](uint64_t hash) {
+            uint64_t pos = levelPos(hash, level) - levelOffsets[level];
+            if (seen[pos]) {
+                collided[pos] = 1;
+            } else {
+                seen[pos] = 1;
+            }
+        };
+        std::vector<uint64_t> next;
+        auto keepCollided = [&](uint64_t hash) {
+            if (!levelBits.back()[levelPos(hash, level) - levelOffsets[level]]) {
+                next.push_back(hash);
+            }
+        };
+        if (level == 0) {
+            forEachKmer(qf, [&](uint64_t hash, uint64_t count) {
+                mark(hash);
+                maxColorId = std::max(maxColorId, count - 1);
+            });
+            addLevel(seen, collided, levelBits);
+            forEachKmer(qf, [&](uint64_t hash, uint64_t) { keepCollided(hash); });
+        } else {
+            for (auto hash : remaining) {
+                mark(hash);
+            }
+            addLevel(seen, collided, levelBits);
+            for (auto hash : remaining) {
+                keepCollided(hash);
+            }
+        }
+        remaining.swap(next);
+    }
+
+    levels = sdsl::bit_vector(levelOffsets.back(), 0);
+    for (uint64_t level = 0; level < levelBits.size(); level++) {
+        std::copy(levelBits[level].data(), levelBits[level].data() + levelBits[level].size() / 64,
+                  levels.data() + levelOffsets[level] / 64);
+    }
+    std::vector<sdsl::bit_vector>().swap(levelBits);
+    sdsl::util::init_support(levelsRank, &levels);
+    numPlaced = levelsRank(levels.size());
+    std::sort(remaining.begin(), remaining.end());
+    fallback.swap(remaining);
+
+    hashes = sdsl::int_vector<>(numKmers, 0, keyBits);
+    colorIds = sdsl::int_vector<>(numKmers, 0, maxColorId ? sdsl::bits::hi(maxColorId) + 1 : 1);
+    forEachKmer(qf, [&](uint64_t hash, uint64_t count) {
+        uint64_t idx = lookup(hash);
+        hashes[idx] = hash;
+        colorIds[idx] = count - 1;
+    });
+
+    uint64_t totalBytes = sdsl::size_in_bytes(levels) + sdsl::size_in_bytes(levelsRank) +
+                          fallback.size() * sizeof(uint64_t) +
+                          sdsl::size_in_bytes(hashes) + sdsl::size_in_bytes(colorIds);
+    logger->info("Static k-mer map: {} k-mers, {} levels, {} in the fallback, {:.2f} bits per k-mer "
+                 "({}-bit hashes, {}-bit color ids)",
+                 numKmers, levelOffsets.size() - 1, fallback.size(),
+                 numKmers ? totalBytes * 8.0 / numKmers : 0.0,
+                 static_cast<uint32_t>(hashes.width()), static_cast<uint32_t>(colorIds.width()));
+}
+
+void StaticKmerMap::serialize(const std::string &filename) const {
+    Header header;
+    header.keyBits = keyBits;
+    header.hashMode = hashMode;
+    header.seed = seed;
+    header.numKmers = numKmers;
+    header.numLevels = levelOffsets.size() - 1;
+    header.numFallback = fallback.size();
+    header.range = range;
+    std::ofstream out(filename, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(levelOffsets.data()), levelOffsets.size() * sizeof(uint64_t));
+    levels.serialize(out);
+    out.write(reinterpret_cast<const char *>(fallback.data()), fallback.size() * sizeof(uint64_t));
+    hashes.serialize(out);
+    colorIds.serialize(out);
+}
+
+/**
+ * @param filename file written by serialize
+ * @return false if the file is not a static k-mer map of this version
+ */
+bool StaticKmerMap::load(const std::string &filename) {
+    std::ifstream in(filename, std::ios::binary);
+    Header header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        header.magic != mantis::STATIC_MAP_MAGIC || header.version != mantis::STATIC_MAP_VERSION) {
+        return false;
+    }
+    keyBits = header.keyBits;
+    hashMode = header.hashMode;
+    seed = header.seed;
+    numKmers = header.numKmers;
+    range = header.range;
+    levelOffsets.resize(header.numLevels + 1);
+    in.read(reinterpret_cast<char *>(levelOffsets.data()), levelOffsets.size() * sizeof(uint64_t));
+    levels.load(in);
+    fallback.resize(header.numFallback);
+    in.read(reinterpret_cast<char *>(fallback.data()), fallback.size() * sizeof(uint64_t));
+    hashes.load(in);
+    colorIds.load(in);
+    sdsl::util::init_support(levelsRank, &levels);
+    numPlaced = levelsRank(levels.size());
+    return static_cast<bool>(in);
+}
+
+void StaticKmerMap::useHugePages(spdlog::logger *logger) {
+    std::pair<const void *, uint64_t> vectors[] = {
+            {levels.data(), levels.capacity() / 8},
+            {hashes.data(), hashes.capacity() / 8},
+            {colorIds.data(), colorIds.capacity() / 8}};
+    uint64_t totalBytes{0}, hugeBytes{0};
+    for (auto &v : vectors) {
+        advise_huge_pages(v.first, v.second);
+        totalBytes += v.second;
+        hugeBytes += anon_huge_page_bytes(v.first, v.second);
+    }
+    logger->info("Static k-mer map: {:.1f} of {:.1f} MiB in transparent huge pages",
+                 hugeBytes / 1048576.0, totalBytes / 1048576.0);
+}
+
+uint64_t StaticKmerMap::query(const KeyObject &k, uint8_t flags) const {
+    uint64_t hash = (flags & QF_KEY_IS_HASH) ? k.key : hashKey(k.key);
+    uint64_t idx = lookup(hash);
+    if (idx == numKmers || hashes[idx] != hash) {
+        return 0;
+    }
+    return colorIds[idx] + 1;
+}
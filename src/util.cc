@@ -1,4 +1,11 @@
+#include <algorithm>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include "util.h"
+#include "gqf/gqf_int.h"
 
 std::string last_part(std::string str, char c) {
 	uint64_t found = str.find_last_of(c);
@@ -25,3 +32,152 @@ void print_time_elapsed(std::string desc, struct timeval* start, struct
 	std::cout << desc << "Total Time Elapsed: " << std::to_string(time_elapsed) << 
 		"seconds" << std::endl;
 }
+
+// Linux 6.1+, not in older libc headers; older kernels reject it with EINVAL
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+
+/* Size of the transparent huge pages (the PMD size), 2MB if unknown */
+static uint64_t thp_page_size(void)
+{
+	uint64_t size = 0;
+	std::ifstream in("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+	if (!(in >> size) || size == 0)
+		size = 2ULL << 20;
+	return size;
+}
+
+void advise_huge_pages(const void* addr, uint64_t len)
+{
+	uint64_t page_size = thp_page_size();
+	uintptr_t start = ((uintptr_t)addr + page_size - 1) & ~(page_size - 1);
+	uintptr_t end = ((uintptr_t)addr + len) & ~(page_size - 1);
+	if (start >= end)
+		return;
+#ifdef MADV_HUGEPAGE
+	madvise((void*)start, end - start, MADV_HUGEPAGE);
+#endif
+	madvise((void*)start, end - start, MADV_COLLAPSE);
+}
+
+uint64_t anon_huge_page_bytes(const void* addr, uint64_t len)
+{
+	uintptr_t begin = (uintptr_t)addr, end = begin + len;
+	std::ifstream smaps("/proc/self/smaps");
+	std::string line;
+	uint64_t overlap = 0;
+	uint64_t bytes = 0;
+	while (std::getline(smaps, line)) {
+		uintptr_t vma_begin, vma_end;
+		uint64_t kb;
+		// a mapping header is "begin-end perms ...", its fields follow
+		if (sscanf(line.c_str(), "%" SCNxPTR "-%" SCNxPTR " ", &vma_begin,
+							 &vma_end) == 2) {
+			uintptr_t lo = std::max(begin, vma_begin), hi = std::min(end, vma_end);
+			overlap = lo < hi ? hi - lo : 0;
+		} else if (overlap && sscanf(line.c_str(), "AnonHugePages: %" SCNu64
+																 " kB", &kb) == 1) {
+			// the mapping can extend past the range (merged with its neighbors)
+			bytes += std::min(kb * 1024, overlap);
+		}
+	}
+	return bytes;
+}
+
+std::string cqf_page_info(const QF* qf)
+{
+	uint64_t page_size;
+	switch (qf_get_page_kind(qf, &page_size)) {
+		case QF_PAGES_HUGETLB:
+			return std::to_string(page_size >> 10) + " KiB hugetlb pages";
+		case QF_PAGES_TRANSPARENT: {
+			uint64_t len = sizeof(qfmetadata) + qf->metadata->total_size_in_bytes;
+			char info[128];
+			snprintf(info, sizeof(info), "%.1f of %.1f MiB in transparent huge pages",
+							 anon_huge_page_bytes(qf->metadata, len) / 1048576.0, len /
+							 1048576.0);
+			return info;
+		}
+		default:
+			return std::to_string(page_size >> 10) + " KiB pages";
+	}
+}
+
+std::vector<uint32_t> numa_nodes(void)
+{
+	std::vector<uint32_t> nodes;
+	// a list of ranges, e.g. "0-1,4"
+	std::ifstream in("/sys/devices/system/node/online");
+	std::string range;
+	while (std::getline(in, range, ',')) {
+		uint32_t first, last;
+		int n = sscanf(range.c_str(), "%u-%u", &first, &last);
+		if (n < 1)
+			continue;
+		if (n == 1)
+			last = first;
+		for (uint32_t node = first; node <= last; node++)
+			nodes.push_back(node);
+	}
+	if (nodes.empty())
+		nodes.push_back(0);
+	return nodes;
+}
+
+bool set_numa_interleave(bool enabled)
+{
+	// from linux/mempolicy.h, called directly to not depend on libnuma
+	const int mpol_default = 0, mpol_interleave = 3;
+	if (!enabled)
+		return syscall(SYS_set_mempolicy, mpol_default, NULL, 0) == 0;
+	std::vector<uint32_t> nodes = numa_nodes();
+	uint32_t max_node = *std::max_element(nodes.begin(), nodes.end());
+	const uint32_t bits = 8 * sizeof(unsigned long);
+	std::vector<unsigned long> mask(max_node / bits + 1);
+	for (auto node : nodes)
+		mask[node / bits] |= 1UL << (node % bits);
+	return syscall(SYS_set_mempolicy, mpol_interleave, mask.data(), max_node +
+								 2) == 0;
+}
+
+std::vector<uint64_t> numa_bytes_per_node(void)
+{
+	std::vector<uint64_t> bytes;
+	std::ifstream numa_maps("/proc/self/numa_maps");
+	std::string line;
+	while (std::getline(numa_maps, line)) {
+		// "<address> <policy> ... N0=<pages> N1=<pages> ... kernelpagesize_kB=4"
+		std::istringstream fields(line);
+		std::string field;
+		std::vector<std::pair<uint32_t, uint64_t>> node_pages;
+		uint64_t page_kb = 4;
+		while (fields >> field) {
+			uint32_t node;
+			uint64_t pages;
+			if (sscanf(field.c_str(), "N%u=%" SCNu64, &node, &pages) == 2)
+				node_pages.emplace_back(node, pages);
+			else
+				sscanf(field.c_str(), "kernelpagesize_kB=%" SCNu64, &page_kb);
+		}
+		for (auto& np : node_pages) {
+			if (np.first >= bytes.size())
+				bytes.resize(np.first + 1);
+			bytes[np.first] += np.second * page_kb * 1024;
+		}
+	}
+	return bytes;
+}
+
+std::string numa_placement_info(void)
+{
+	std::vector<uint64_t> bytes = numa_bytes_per_node();
+	std::string info;
+	for (uint32_t node = 0; node < bytes.size(); node++) {
+		char node_info[64];
+		snprintf(node_info, sizeof(node_info), "%snode %u: %.1f MiB",
+						 info.empty() ? "" : ", ", node, bytes[node] / 1048576.0);
+		info += node_info;
+	}
+	return info;
+}
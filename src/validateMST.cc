@@ -40,8 +40,10 @@ std::vector<uint64_t> buildColor(eqvec &bvs,
     std::vector<uint64_t> eq;
     eq.reserve(num_samples);
     uint64_t i{0}, bitcnt{0};
-    uint64_t idx = eqid / mantis::NUM_BV_BUFFER;
-    uint64_t offset = eqid % mantis::NUM_BV_BUFFER;
+    // every file but the last one holds a full buffer of color classes
+    uint64_t buffer_size = std::max<uint64_t>(bvs[0].size() / num_samples, 1);
+    uint64_t idx = eqid / buffer_size;
+    uint64_t offset = eqid % buffer_size;
 //std::cerr << eqid << " " << num_samples << " " << idx << " " << offset << "\n";
     while (i<num_samples) {
         bitcnt = std::min(num_samples - i, (uint64_t) 64);
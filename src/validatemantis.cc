@@ -131,6 +131,10 @@ validate_main ( ValidateOpts& opt )
 	std::string sample_file(prefix + mantis::SAMPLEID_FILE);
 	std::vector<std::string> eqclass_files = mantis::fs::GetFilesExt(prefix.c_str(),
 																																	 mantis::EQCLASS_FILE);
+	// index built with --color-matrix
+	if (eqclass_files.empty())
+		eqclass_files = mantis::fs::GetFilesExt(prefix.c_str(),
+																						mantis::COLOR_MATRIX_FILE);
 
 	ColoredDbg<SampleObject<CQF<KeyObject>*>, KeyObject> cdbg(dbg_file,
 																														eqclass_files,
@@ -154,7 +158,7 @@ validate_main ( ValidateOpts& opt )
 	// Query kmers in each experiment CQF
 	// Maintain the fraction of kmers present in each experiment CQF.
 	std::vector<std::unordered_map<uint64_t, float>> ground_truth;
-	std::vector<std::vector<uint64_t>> cdbg_output;
+	mantis::QueryResults cdbg_output;
 	bool fail{false};
 	for (auto kmers : multi_kmers) {
 		std::unordered_map<uint64_t, float> fraction_present;
@@ -167,7 +171,8 @@ validate_main ( ValidateOpts& opt )
 			}
 		}
 		// Query kmers in the cdbg
-		std::vector<uint64_t> result = cdbg.find_samples(kmers);
+		mantis::QueryResult result(cdbg.get_num_samples());
+		cdbg.find_samples(kmers, result);
 
 		// Validate the cdbg output
 		for (uint64_t i = 0; i < nqf; i++)